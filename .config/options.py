@@ -72,6 +72,7 @@ def resolve():
     opt_new_from_pkg('gtk3', 'gtk+-3.0', pversion = '--atleast-version=3.20')
     opt_new_from_pkg('gmodule2', 'gmodule-2.0')
     opt_new_from_pkg('x11', 'x11')
+    opt_new_from_pkg('x11xcb', 'x11-xcb')
     opt_new('cflags_extra', default='-I$(TOPDIR)/panel')
 
 def detect_project_name():
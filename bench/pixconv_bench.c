@@ -0,0 +1,257 @@
+/*
+ * Microbenchmark of pixconv.c.
+ *
+ * Times every ARGB <-> RGBA kernel the CPU can run on square icons from
+ * 16x16 to 256x256, and checks each one's output against scalar kernel.
+ * Then times fb_pixbuf_scale against gdk_pixbuf_scale_simple at scaling
+ * ratios the panel uses, and tells how close every result comes to the
+ * GDK_INTERP_HYPER one.
+ *
+ * Not built by default. After ./configure run
+ *   make -C bench && ./bench/pixconv_bench
+ * Exit status is non-zero if any kernel disagrees with scalar one.
+ */
+
+#include <math.h>
+#include <string.h>
+
+/* kernels are static, so they are compiled right in */
+#include "panel/pixconv.c"
+
+/* each measurement runs for at least that long */
+#define BENCH_USEC 200000
+
+typedef struct {
+    const char *name;
+    argb_to_rgba_func to_rgba;
+    rgba_to_argb_func to_argb;
+} kernel;
+
+static kernel kernels[] = {
+    { "scalar", argb_to_rgba_c, rgba_to_argb_c },
+#ifdef PIXCONV_X86
+    { "sse2", argb_to_rgba_sse2, rgba_to_argb_sse2 },
+    { "avx2", argb_to_rgba_avx2, rgba_to_argb_avx2 },
+#endif
+};
+
+static const int icon_sizes[] = { 16, 32, 48, 64, 128, 256 };
+
+static gboolean
+kernel_usable(kernel *k)
+{
+#ifdef PIXCONV_X86
+    __builtin_cpu_init();
+    if (!strcmp(k->name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+#endif
+    return TRUE;
+}
+
+/* average time of one call, in nanoseconds */
+#define BENCH(ns, call)                                     \
+    do {                                                    \
+        gint64 _t0 = g_get_monotonic_time(), _t;            \
+        long _n = 0;                                        \
+        do {                                                \
+            call;                                           \
+            _n++;                                           \
+        } while ((_t = g_get_monotonic_time() - _t0) < BENCH_USEC); \
+        (ns) = 1000.0 * _t / _n;                            \
+    } while (0)
+
+/* Checks kernel against scalar one on n pixels, and on n - 3 too, so
+ * that tail loops are covered as well */
+static gboolean
+check_kernel(kernel *k, const gulong *argb, const guchar *rgba, int n)
+{
+    guchar *dst, *ref;
+    gulong *ldst, *lref;
+    gboolean ok = TRUE;
+    int m;
+
+    dst = g_malloc(4 * n);
+    ref = g_malloc(4 * n);
+    ldst = g_new(gulong, n);
+    lref = g_new(gulong, n);
+    for (m = n; m >= n - 3 && m > 0; m -= 3) {
+        argb_to_rgba_c(argb, ref, m);
+        k->to_rgba(argb, dst, m);
+        ok = ok && !memcmp(dst, ref, 4 * m);
+        rgba_to_argb_c(rgba, lref, m);
+        k->to_argb(rgba, ldst, m);
+        ok = ok && !memcmp(ldst, lref, sizeof(gulong) * m);
+    }
+    g_free(lref);
+    g_free(ldst);
+    g_free(ref);
+    g_free(dst);
+    return ok;
+}
+
+static gboolean
+bench_kernels(void)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+    gboolean all_ok = TRUE, ok;
+    gulong *argb, *ldst;
+    guchar *rgba, *dst;
+    double ns_rgba, ns_argb;
+    int i, j, s, n;
+    kernel *k;
+
+    printf("%-9s %-6s %16s %16s  %s\n", "icon", "kernel",
+        "argb->rgba ns/px", "rgba->argb ns/px", "check");
+    for (i = 0; i < G_N_ELEMENTS(icon_sizes); i++) {
+        s = icon_sizes[i];
+        n = s * s;
+        argb = g_new(gulong, n);
+        ldst = g_new(gulong, n);
+        rgba = g_malloc(4 * n);
+        dst = g_malloc(4 * n);
+        for (j = 0; j < n; j++) {
+            /* _NET_WM_ICON has junk in upper half of 64 bit longs */
+            argb[j] = (gulong) g_rand_int(rand) << 16 << 16
+                | g_rand_int(rand);
+            ((guint32 *) rgba)[j] = g_rand_int(rand);
+        }
+        for (j = 0; j < G_N_ELEMENTS(kernels); j++) {
+            k = &kernels[j];
+            if (!kernel_usable(k))
+                continue;
+            ok = check_kernel(k, argb, rgba, n);
+            all_ok = all_ok && ok;
+            BENCH(ns_rgba, k->to_rgba(argb, dst, n));
+            BENCH(ns_argb, k->to_argb(rgba, ldst, n));
+            printf("%3dx%-5d %-6s %16.3f %16.3f  %s\n", s, s, k->name,
+                ns_rgba / n, ns_argb / n, ok ? "ok" : "MISMATCH");
+        }
+        g_free(dst);
+        g_free(rgba);
+        g_free(ldst);
+        g_free(argb);
+    }
+    g_rand_free(rand);
+    return all_ok;
+}
+
+/* source and target sizes as panel has them */
+static const struct {
+    const char *what;
+    int sw, sh, w, h;
+} scale_cases[] = {
+    { "taskbar _NET_WM_ICON", 256, 256, 24, 24 },
+    { "taskbar _NET_WM_ICON", 128, 128, 24, 24 },
+    { "taskbar _NET_WM_ICON", 48, 48, 24, 24 },
+    { "taskbar WM_HINTS icon", 64, 64, 22, 22 },
+    { "launcher press image", 24, 24, 20, 20 },
+    { "launcher press image", 48, 48, 44, 44 },
+    { "image plugin", 512, 512, 30, 30 },
+    /* pager makes its wallpaper thumbnail with cairo now, the case is
+     * here for comparison */
+    { "pager desk thumbnail", 1920, 1080, 46, 26 },
+};
+
+/* Icon-like test picture: fine rings that alias when scaled poorly,
+ * on a disc that fades out to transparent corners */
+static GdkPixbuf *
+make_picture(int w, int h)
+{
+    GdkPixbuf *pix;
+    guchar *p, *q;
+    int x, y, stride;
+    double dx, dy, r, a;
+
+    pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w, h);
+    p = gdk_pixbuf_get_pixels(pix);
+    stride = gdk_pixbuf_get_rowstride(pix);
+    for (y = 0; y < h; y++, p += stride) {
+        for (x = 0, q = p; x < w; x++, q += 4) {
+            dx = (x - w / 2.0) / w;
+            dy = (y - h / 2.0) / h;
+            r = sqrt(dx * dx + dy * dy);
+            a = CLAMP((0.5 - r) * 8, 0, 1);
+            q[0] = 127.5 + 127.5 * sin(r * r * 2000);
+            q[1] = 255.0 * x / w;
+            q[2] = (x / 4 + y / 4) % 2 ? 220 : 30;
+            q[3] = 255 * a;
+        }
+    }
+    return pix;
+}
+
+/* PSNR of b against a, over premultiplied colors, since colour of
+ * transparent pixel does not matter */
+static double
+psnr(GdkPixbuf *a, GdkPixbuf *b)
+{
+    const guchar *pa, *pb;
+    int x, y, i, w, h, sa, sb;
+    double d, se = 0;
+
+    w = gdk_pixbuf_get_width(a);
+    h = gdk_pixbuf_get_height(a);
+    sa = gdk_pixbuf_get_rowstride(a);
+    sb = gdk_pixbuf_get_rowstride(b);
+    for (y = 0; y < h; y++) {
+        pa = gdk_pixbuf_get_pixels(a) + y * sa;
+        pb = gdk_pixbuf_get_pixels(b) + y * sb;
+        for (x = 0; x < w; x++, pa += 4, pb += 4) {
+            for (i = 0; i < 4; i++) {
+                d = (i < 3) ? (pa[i] * pa[3] - pb[i] * pb[3]) / 255.0
+                    : pa[3] - pb[3];
+                se += d * d;
+            }
+        }
+    }
+    if (se == 0)
+        return INFINITY;
+    return 10 * log10(255.0 * 255.0 / (se / (4.0 * w * h)));
+}
+
+static void
+bench_scale(void)
+{
+    GdkPixbuf *src, *hyper, *bilinear, *fb;
+    double ns_hyper, ns_bilinear, ns_fb;
+    int i, w, h;
+
+    printf("\n%-22s %-9s %-5s %10s %10s %10s  %s\n", "scale", "from", "to",
+        "hyper us", "bilin us", "fb us", "PSNR vs hyper: bilinear, fb");
+    for (i = 0; i < G_N_ELEMENTS(scale_cases); i++) {
+        w = scale_cases[i].w;
+        h = scale_cases[i].h;
+        src = make_picture(scale_cases[i].sw, scale_cases[i].sh);
+        BENCH(ns_hyper, g_object_unref(
+                gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_HYPER)));
+        BENCH(ns_bilinear, g_object_unref(
+                gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_BILINEAR)));
+        BENCH(ns_fb, g_object_unref(fb_pixbuf_scale(src, w, h)));
+        hyper = gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_HYPER);
+        bilinear = gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_BILINEAR);
+        fb = fb_pixbuf_scale(src, w, h);
+        printf("%-22s %4dx%-4d %2dx%-2d %10.1f %10.1f %10.1f  %.1f dB, "
+            "%.1f dB\n", scale_cases[i].what,
+            scale_cases[i].sw, scale_cases[i].sh, w, h,
+            ns_hyper / 1000, ns_bilinear / 1000, ns_fb / 1000,
+            psnr(hyper, bilinear), psnr(hyper, fb));
+        g_object_unref(fb);
+        g_object_unref(bilinear);
+        g_object_unref(hyper);
+        g_object_unref(src);
+    }
+}
+
+int log_level;
+
+int
+main(void)
+{
+    gboolean ok;
+
+    ok = bench_kernels();
+    bench_scale();
+    if (!ok)
+        fprintf(stderr, "pixconv_bench: some kernel disagrees with scalar one\n");
+    return ok ? 0 : 1;
+}
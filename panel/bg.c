@@ -124,7 +124,7 @@ fb_bg_init (FbBg *bg)
     //bg->dpy = GDK_DISPLAY();
     bg->dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
     bg->xroot = DefaultRootWindow(bg->dpy);
-    bg->id = XInternAtom(bg->dpy, "_XROOTPMAP_ID", False);
+    bg->id = a_XROOTPMAP_ID;
     bg->pixmap = fb_bg_get_xrootpmap_real(bg);
     gcv.ts_x_origin = 0;
     gcv.ts_y_origin = 0;
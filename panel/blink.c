@@ -0,0 +1,136 @@
+/*
+ * Shared blink scheduler.
+ *
+ * Every urgent item used to have its own timer, so ten urgent windows
+ * meant ten unrelated wakeups per period, and buttons blinking out of
+ * step. Here one timer toggles them all in a single tick.
+ */
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "blink.h"
+
+//#define DEBUGPRN
+#include "dbg.h"
+
+/* used if gtk-cursor-blink-time makes no sense */
+#define BLINK_PERIOD  1200
+
+typedef struct {
+    fb_blink_func func;         /* NULL if removed while ticking */
+    gpointer data;
+} blink_item;
+
+static GSList *items;
+static guint timer;
+static gboolean phase;
+static gboolean ticking;
+static gboolean dirty;
+
+/* drops items that were removed during tick */
+static void
+blink_compact(void)
+{
+    GSList *l, *next;
+
+    ENTER;
+    for (l = items; l; l = next) {
+        next = l->next;
+        if (!((blink_item *) l->data)->func) {
+            g_free(l->data);
+            items = g_slist_delete_link(items, l);
+        }
+    }
+    dirty = FALSE;
+    RET();
+}
+
+static gboolean
+blink_tick(gpointer data)
+{
+    blink_item *b;
+    GSList *l;
+
+    ENTER;
+    phase = !phase;
+    ticking = TRUE;
+    for (l = items; l; l = l->next) {
+        b = l->data;
+        if (b->func)
+            b->func(phase, b->data);
+    }
+    ticking = FALSE;
+    if (dirty)
+        blink_compact();
+    if (!items) {
+        DBG("stop\n");
+        timer = 0;
+        RET(FALSE);
+    }
+    RET(TRUE);
+}
+
+static GSList *
+blink_find(fb_blink_func func, gpointer data)
+{
+    blink_item *b;
+    GSList *l;
+
+    for (l = items; l; l = l->next) {
+        b = l->data;
+        if (b->func == func && b->data == data)
+            return l;
+    }
+    return NULL;
+}
+
+void
+fb_blink_add(fb_blink_func func, gpointer data)
+{
+    blink_item *b;
+    gint period = 0;
+
+    ENTER;
+    g_return_if_fail(func != NULL);
+    if (blink_find(func, data))
+        RET();
+    b = g_new(blink_item, 1);
+    b->func = func;
+    b->data = data;
+    items = g_slist_append(items, b);
+    if (!timer) {
+        g_object_get(gtk_settings_get_default(), "gtk-cursor-blink-time",
+            &period, NULL);
+        if (period < 100)
+            period = BLINK_PERIOD;
+        DBG("start, period %d\n", period);
+        phase = TRUE;
+        timer = g_timeout_add(period, blink_tick, NULL);
+    }
+    func(phase, data);
+    RET();
+}
+
+void
+fb_blink_remove(fb_blink_func func, gpointer data)
+{
+    GSList *l;
+
+    ENTER;
+    if (!(l = blink_find(func, data)))
+        RET();
+    if (ticking) {
+        ((blink_item *) l->data)->func = NULL;
+        dirty = TRUE;
+        RET();
+    }
+    g_free(l->data);
+    items = g_slist_delete_link(items, l);
+    if (!items && timer) {
+        DBG("stop\n");
+        g_source_remove(timer);
+        timer = 0;
+    }
+    RET();
+}
@@ -0,0 +1,17 @@
+#ifndef BLINK_H
+#define BLINK_H
+
+#include <glib.h>
+
+/* Blinking of urgent items: task buttons, pager windows and such. One
+ * panel-wide timer, ticking at cursor blink rate, switches all of them
+ * at once; it runs only while something is registered.
+ *
+ * func is called with new phase on every tick, and right away with
+ * current phase when item is added */
+typedef void (*fb_blink_func)(gboolean on, gpointer data);
+
+void fb_blink_add(fb_blink_func func, gpointer data);
+void fb_blink_remove(fb_blink_func func, gpointer data);
+
+#endif
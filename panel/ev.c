@@ -29,14 +29,25 @@
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ev.h"
 #include "misc.h"
+#include "xev.h"
 
 //#define DEBUGPRN
 #include "dbg.h"
 
+/* For older Xlib headers */
+#ifndef XUrgencyHint
+#define XUrgencyHint (1 << 8)
+#endif
+
 
 
 struct _FbEvClass {
@@ -48,6 +59,9 @@ struct _FbEvClass {
     void (*desktop_names)(FbEv *ev, gpointer p);
     void (*client_list)(FbEv *ev, gpointer p);
     void (*client_list_stacking)(FbEv *ev, gpointer p);
+    void (*window_added)(FbEv *ev, fb_client *c);
+    void (*window_changed)(FbEv *ev, fb_client *c);
+    void (*window_removed)(FbEv *ev, fb_client *c);
 };
 
 struct _FbEv {
@@ -56,9 +70,26 @@ struct _FbEv {
     int current_desktop;
     int number_of_desktops;
     char **desktop_names;
+    int desktop_names_num;
     Window active_window;
+    gboolean active_window_valid;
     Window *client_list;
+    int client_num;
     Window *client_list_stacking;
+    int client_stacking_num;
+
+    /* registry of managed windows, created on first use */
+    GHashTable *clients;
+    fb_atom_table *client_atoms;    /* property atom -> FB_CLIENT_* bits */
+    guint clients_mark;
+    GSList *pending;            /* clients with queued updates */
+    guint flush_id;
+    fb_trace_stamp flush_stamp;     /* first event of the burst */
+    GSList *resync;             /* clients with unknown root position */
+    guint resync_id;
+    int burst_events;
+    /* burst compression ratio, in xstat dump */
+    gulong stats_events, stats_windows, stats_updates, stats_flushes;
 
     Window   xroot;
     Atom     id;
@@ -77,6 +108,9 @@ static void ev_number_of_desktops(FbEv *ev, gpointer p);
 static void ev_desktop_names(FbEv *ev, gpointer p);
 static void ev_client_list(FbEv *ev, gpointer p);
 static void ev_client_list_stacking(FbEv *ev, gpointer p);
+static void ev_clients_sync(FbEv *ev);
+static GdkFilterReturn client_propertynotify(XEvent *xev, fb_client *c);
+static GdkFilterReturn client_configurenotify(XEvent *xev, fb_client *c);
 
 static guint signals [EV_LAST_SIGNAL] = { 0 };
 
@@ -161,6 +195,30 @@ fb_ev_class_init (FbEvClass *klass)
               NULL, NULL,
               g_cclosure_marshal_VOID__VOID,
               G_TYPE_NONE, 0);
+    signals [EV_WINDOW_ADDED] =
+        g_signal_new ("window_added",
+              G_OBJECT_CLASS_TYPE (object_class),
+              G_SIGNAL_RUN_FIRST,
+              G_STRUCT_OFFSET (FbEvClass, window_added),
+              NULL, NULL,
+              g_cclosure_marshal_VOID__POINTER,
+              G_TYPE_NONE, 1, G_TYPE_POINTER);
+    signals [EV_WINDOW_CHANGED] =
+        g_signal_new ("window_changed",
+              G_OBJECT_CLASS_TYPE (object_class),
+              G_SIGNAL_RUN_FIRST,
+              G_STRUCT_OFFSET (FbEvClass, window_changed),
+              NULL, NULL,
+              g_cclosure_marshal_VOID__POINTER,
+              G_TYPE_NONE, 1, G_TYPE_POINTER);
+    signals [EV_WINDOW_REMOVED] =
+        g_signal_new ("window_removed",
+              G_OBJECT_CLASS_TYPE (object_class),
+              G_SIGNAL_RUN_FIRST,
+              G_STRUCT_OFFSET (FbEvClass, window_removed),
+              NULL, NULL,
+              g_cclosure_marshal_VOID__POINTER,
+              G_TYPE_NONE, 1, G_TYPE_POINTER);
     object_class->finalize = fb_ev_finalize;
 
     klass->current_desktop = ev_current_desktop;
@@ -177,8 +235,33 @@ fb_ev_init (FbEv *ev)
     ev->number_of_desktops = -1;
     ev->current_desktop = -1;
     ev->active_window = None;
+    ev->active_window_valid = FALSE;
+    ev->desktop_names = NULL;
+    ev->desktop_names_num = 0;
     ev->client_list_stacking = NULL;
+    ev->client_stacking_num = 0;
     ev->client_list = NULL;
+    ev->client_num = 0;
+    ev->clients = NULL;
+    ev->pending = NULL;
+    ev->flush_id = 0;
+    fb_xstat_add_counter("ev events queued", &ev->stats_events);
+    fb_xstat_add_counter("ev windows refetched", &ev->stats_windows);
+    fb_xstat_add_counter("ev windows changed", &ev->stats_updates);
+    fb_xstat_add_counter("ev flushes", &ev->stats_flushes);
+    ev->resync = NULL;
+    ev->resync_id = 0;
+
+    /* atoms are resolved by now */
+    ev->client_atoms = fb_atom_table_new();
+    fb_atom_table_add(ev->client_atoms, a_NET_WM_STATE, FB_CLIENT_STATE);
+    fb_atom_table_add(ev->client_atoms, a_NET_WM_DESKTOP, FB_CLIENT_DESKTOP);
+    fb_atom_table_add(ev->client_atoms, a_NET_WM_NAME, FB_CLIENT_NAME);
+    fb_atom_table_add(ev->client_atoms, XA_WM_NAME, FB_CLIENT_NAME);
+    fb_atom_table_add(ev->client_atoms, a_NET_WM_WINDOW_TYPE, FB_CLIENT_TYPE);
+    fb_atom_table_add(ev->client_atoms, XA_WM_CLASS, FB_CLIENT_CLASS);
+    fb_atom_table_add(ev->client_atoms, XA_WM_HINTS, FB_CLIENT_HINTS);
+    fb_atom_table_add(ev->client_atoms, a_NET_WM_ICON, FB_CLIENT_ICON);
 }
 
 
@@ -188,12 +271,40 @@ fb_ev_new()
     return  g_object_new (FB_TYPE_EV, NULL);
 }
 
+static void client_free(fb_client *c);
+
 static void
 fb_ev_finalize (GObject *object)
 {
-    FbEv *ev G_GNUC_UNUSED;
+    FbEv *ev;
 
     ev = FB_EV (object);
+    fb_xstat_remove_counter(&ev->stats_events);
+    fb_xstat_remove_counter(&ev->stats_windows);
+    fb_xstat_remove_counter(&ev->stats_updates);
+    fb_xstat_remove_counter(&ev->stats_flushes);
+    if (ev->flush_id)
+        g_source_remove(ev->flush_id);
+    g_slist_free(ev->pending);
+    if (ev->resync_id)
+        g_source_remove(ev->resync_id);
+    g_slist_free(ev->resync);
+    if (ev->clients) {
+        GHashTableIter iter;
+        fb_client *c;
+
+        g_hash_table_iter_init(&iter, ev->clients);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &c))
+            client_free(c);
+        g_hash_table_destroy(ev->clients);
+    }
+    fb_atom_table_free(ev->client_atoms);
+    if (ev->client_list)
+        XFree(ev->client_list);
+    if (ev->client_list_stacking)
+        XFree(ev->client_list_stacking);
+    if (ev->desktop_names)
+        g_strfreev(ev->desktop_names);
     //XFreeGC(ev->dpy, ev->gc);
 }
 
@@ -219,6 +330,7 @@ ev_active_window(FbEv *ev, gpointer p)
 {
     ENTER;
     ev->active_window = None;
+    ev->active_window_valid = FALSE;
     RET();
 }
 
@@ -237,6 +349,7 @@ ev_desktop_names(FbEv *ev, gpointer p)
     if (ev->desktop_names) {
         g_strfreev (ev->desktop_names);
         ev->desktop_names = NULL;
+        ev->desktop_names_num = 0;
     }
     RET();
 }
@@ -247,7 +360,10 @@ ev_client_list(FbEv *ev, gpointer p)
     if (ev->client_list) {
         XFree(ev->client_list);
         ev->client_list = NULL;
+        ev->client_num = 0;
     }
+    if (ev->clients)
+        ev_clients_sync(ev);
     RET();
 }
 
@@ -258,6 +374,7 @@ ev_client_list_stacking(FbEv *ev, gpointer p)
     if (ev->client_list_stacking) {
         XFree(ev->client_list_stacking);
         ev->client_list_stacking = NULL;
+        ev->client_stacking_num = 0;
     }
     RET();
 }
@@ -297,6 +414,700 @@ fb_ev_number_of_desktops(FbEv *ev)
 
 }
 
-Window fb_ev_active_window(FbEv *ev);
-Window *fb_ev_client_list(FbEv *ev);
-Window *fb_ev_client_list_stacking(FbEv *ev);
+/* names are owned by ev and stay valid until next "desktop_names" signal */
+char **
+fb_ev_desktop_names(FbEv *ev, int *num)
+{
+    ENTER;
+    if (!ev->desktop_names)
+        ev->desktop_names = get_utf8_property_list(GDK_ROOT_WINDOW(),
+            a_NET_DESKTOP_NAMES, &ev->desktop_names_num);
+    if (num)
+        *num = ev->desktop_names_num;
+    RET(ev->desktop_names);
+}
+
+Window
+fb_ev_active_window(FbEv *ev)
+{
+    ENTER;
+    if (!ev->active_window_valid) {
+        Window *data;
+        int num;
+
+        data = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_ACTIVE_WINDOW, XA_WINDOW, &num);
+        if (data) {
+            ev->active_window = num ? *data : None;
+            XFree (data);
+        } else
+            ev->active_window = None;
+        ev->active_window_valid = TRUE;
+    }
+    RET(ev->active_window);
+}
+
+/* list is owned by ev and stays valid until next "client_list" signal */
+Window *
+fb_ev_client_list(FbEv *ev, int *num)
+{
+    ENTER;
+    if (!ev->client_list) {
+        ev->client_list = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_CLIENT_LIST,
+            XA_WINDOW, &ev->client_num);
+        if (!ev->client_list)
+            ev->client_num = 0;
+    }
+    if (num)
+        *num = ev->client_num;
+    RET(ev->client_list);
+}
+
+/* list is owned by ev and stays valid until next "client_list_stacking"
+ * signal */
+Window *
+fb_ev_client_list_stacking(FbEv *ev, int *num)
+{
+    ENTER;
+    if (!ev->client_list_stacking) {
+        ev->client_list_stacking = get_xaproperty (GDK_ROOT_WINDOW(),
+            a_NET_CLIENT_LIST_STACKING, XA_WINDOW, &ev->client_stacking_num);
+        if (!ev->client_list_stacking)
+            ev->client_stacking_num = 0;
+    }
+    if (num)
+        *num = ev->client_stacking_num;
+    RET(ev->client_list_stacking);
+}
+
+/*****************************************************************
+ * Client registry                                               *
+ *****************************************************************/
+
+/* Every plugin that tracks windows used to keep its own copy of
+ * their state and to refetch it on each event. The registry does it
+ * once for all of them and reports what was changed via "window_added",
+ * "window_changed" and "window_removed" signals */
+
+static void
+client_get_geometry(fb_client *c)
+{
+    Display *dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+    Window root, junkwin;
+    int rx, ry;
+    guint dummy;
+    XWindowAttributes win_attributes;
+    gint64 t;
+
+    ENTER;
+    t = fb_xstat_begin();
+    if (!XGetWindowAttributes(dpy, c->win, &win_attributes)) {
+        if (!XGetGeometry (dpy, c->win, &root, &c->x, &c->y, &c->w, &c->h,
+                  &dummy, &dummy)) {
+            c->x = c->y = c->w = c->h = 2;
+        }
+        fb_xstat_end(t, "GetGeometry", FB_XSTAT_HERE, 2, 32);
+    } else {
+        XTranslateCoordinates (dpy, c->win, win_attributes.root,
+              -win_attributes.border_width,
+              -win_attributes.border_width,
+              &rx, &ry, &junkwin);
+        c->x = rx;
+        c->y = ry;
+        c->w = win_attributes.width;
+        c->h = win_attributes.height;
+        DBG("win=0x%lx WxH=%dx%d\n", c->win, c->w, c->h);
+        /* XGetWindowAttributes is GetWindowAttributes + GetGeometry */
+        fb_xstat_end(t, "GetWindowAttributes", FB_XSTAT_HERE, 3, 44 + 32 + 32);
+    }
+    RET();
+}
+
+static gchar *
+client_get_name(Window win)
+{
+    gchar *name;
+
+    ENTER;
+    name = get_utf8_property(win, a_NET_WM_NAME);
+    if (!name)
+        name = get_textproperty(win, XA_WM_NAME);
+    RET(name);
+}
+
+static void
+client_free_class(fb_client *c)
+{
+    g_free(c->ch.res_name);
+    g_free(c->ch.res_class);
+    c->ch.res_name = c->ch.res_class = NULL;
+}
+
+/* WM_CLASS is two consecutive null-terminated strings: name and class */
+static void
+client_set_class(fb_client *c, gchar *data, int len)
+{
+    int n;
+
+    ENTER;
+    client_free_class(c);
+    if (!data || len <= 0)
+        RET();
+    c->ch.res_name = g_strdup(data);
+    n = strlen(data) + 1;
+    if (n < len)
+        c->ch.res_class = g_strndup(data + n, len - n);
+    DBG("name=%s class=%s\n", c->ch.res_name, c->ch.res_class);
+    RET();
+}
+
+static void
+client_get_class(fb_client *c)
+{
+    gchar *data;
+    int len;
+
+    ENTER;
+    data = get_xaproperty(c->win, XA_WM_CLASS, XA_STRING, &len);
+    client_set_class(c, data, len);
+    if (data)
+        XFree(data);
+    RET();
+}
+
+/* takes from WM_HINTS what plugins care about: urgency and icon */
+static void
+client_set_hints(fb_client *c, gulong *hints, int num)
+{
+    c->urgency = num > 0 && (hints[0] & XUrgencyHint);
+    c->icon_pixmap = (num > 3 && (hints[0] & IconPixmapHint))
+        ? hints[3] : None;
+    c->icon_mask = (num > 7 && (hints[0] & IconMaskHint))
+        ? hints[7] : None;
+}
+
+static void
+client_get_hints(fb_client *c)
+{
+    gulong *hints;
+    int num;
+
+    ENTER;
+    hints = get_xaproperty(c->win, XA_WM_HINTS, XA_WM_HINTS, &num);
+    client_set_hints(c, hints, hints ? num : 0);
+    if (hints)
+        XFree(hints);
+    RET();
+}
+
+/* properties fetched for every new window, see clients_fetch */
+enum {
+    CP_DESKTOP,
+    CP_STATE,
+    CP_WINDOW_TYPE,
+    CP_NET_WM_NAME,
+    CP_WM_NAME,
+    CP_WM_CLASS,
+    CP_WM_HINTS,
+    CP_LAST
+};
+
+/* Collects replies to GetGeometry and TranslateCoordinates of a window
+ * into its root geometry. Window may have been destroyed since requests
+ * were sent. It is normal race, so errors are taken here instead of being
+ * left to Xlib error handler, and FALSE is returned for the gone window */
+static gboolean
+client_geometry_reply(xcb_connection_t *xc, xcb_get_geometry_cookie_t gc,
+    xcb_translate_coordinates_cookie_t tc, int *x, int *y, guint *w, guint *h)
+{
+    xcb_get_geometry_reply_t *g;
+    xcb_translate_coordinates_reply_t *t;
+    xcb_generic_error_t *gerr = NULL, *terr = NULL;
+    gboolean ok;
+
+    g = xcb_get_geometry_reply(xc, gc, &gerr);
+    t = xcb_translate_coordinates_reply(xc, tc, &terr);
+    if (gerr || terr)
+        DBG("error=%d\n", (gerr ? gerr : terr)->error_code);
+    free(gerr);
+    free(terr);
+    if ((ok = g && t)) {
+        *x = t->dst_x - g->border_width;
+        *y = t->dst_y - g->border_width;
+        *w = g->width;
+        *h = g->height;
+    }
+    free(g);
+    free(t);
+    return ok;
+}
+
+/* Fills in state of new windows. All requests, including geometry, are
+ * sent in one batch, so it costs single round trip no matter how many
+ * windows have appeared. It matters on session start and on remote
+ * displays */
+static void
+clients_fetch(fb_client **cs, int n)
+{
+    Atom props[CP_LAST] = {
+        [CP_DESKTOP]     = a_NET_WM_DESKTOP,
+        [CP_STATE]       = a_NET_WM_STATE,
+        [CP_WINDOW_TYPE] = a_NET_WM_WINDOW_TYPE,
+        [CP_NET_WM_NAME] = a_NET_WM_NAME,
+        [CP_WM_NAME]     = XA_WM_NAME,
+        [CP_WM_CLASS]    = XA_WM_CLASS,
+        [CP_WM_HINTS]    = XA_WM_HINTS,
+    };
+    Atom types[CP_LAST] = {
+        [CP_DESKTOP]     = XA_CARDINAL,
+        [CP_STATE]       = XA_ATOM,
+        [CP_WINDOW_TYPE] = XA_ATOM,
+        [CP_NET_WM_NAME] = a_UTF8_STRING,
+        [CP_WM_NAME]     = AnyPropertyType,
+        [CP_WM_CLASS]    = XA_STRING,
+        [CP_WM_HINTS]    = XA_WM_HINTS,
+    };
+    xcb_connection_t *xc;
+    xcb_get_geometry_cookie_t *gcookies;
+    xcb_translate_coordinates_cookie_t *tcookies;
+    Window *wins;
+    xaprop *props_all, *cp;
+    fb_client *c;
+    int i;
+
+    ENTER;
+    if (n <= 0)
+        RET();
+    xc = XGetXCBConnection(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()));
+    wins = g_new(Window, n);
+    gcookies = g_new(xcb_get_geometry_cookie_t, n);
+    tcookies = g_new(xcb_translate_coordinates_cookie_t, n);
+    for (i = 0; i < n; i++) {
+        wins[i] = cs[i]->win;
+        gcookies[i] = xcb_get_geometry(xc, wins[i]);
+        tcookies[i] = xcb_translate_coordinates(xc, wins[i],
+            GDK_ROOT_WINDOW(), 0, 0);
+    }
+    props_all = get_xaproperty_batch(wins, n, props, types, CP_LAST);
+    /* geometry replies arrive with property ones, so no time of their own */
+    fb_xstat_end(0, "GetGeometry batch", FB_XSTAT_HERE, 2 * n, 64 * n);
+
+    for (i = 0; i < n; i++) {
+        c = cs[i];
+        cp = props_all + i * CP_LAST;
+        c->desktop = cp[CP_DESKTOP].nitems ?
+            ((gulong *) cp[CP_DESKTOP].data)[0] : 0;
+        parse_net_wm_state((Atom *) cp[CP_STATE].data,
+            cp[CP_STATE].nitems, &c->nws);
+        parse_net_wm_window_type((Atom *) cp[CP_WINDOW_TYPE].data,
+            cp[CP_WINDOW_TYPE].nitems, &c->nwwt);
+        c->name = xaprop_to_utf8(&cp[CP_NET_WM_NAME]);
+        if (!c->name)
+            c->name = xaprop_to_utf8(&cp[CP_WM_NAME]);
+        client_set_class(c, cp[CP_WM_CLASS].data, cp[CP_WM_CLASS].nitems);
+        client_set_hints(c, (gulong *) cp[CP_WM_HINTS].data,
+            cp[CP_WM_HINTS].nitems);
+
+        /* gone window is dropped with next _NET_CLIENT_LIST */
+        if (!client_geometry_reply(xc, gcookies[i], tcookies[i],
+                &c->x, &c->y, &c->w, &c->h))
+            c->x = c->y = c->w = c->h = 2;
+        DBG("add %lx %s WxH=%dx%d\n", c->win, c->name, c->w, c->h);
+    }
+    xaprop_batch_free(props_all, n * CP_LAST);
+    g_free(tcookies);
+    g_free(gcookies);
+    g_free(wins);
+    RET();
+}
+
+static fb_client *
+client_new(FbEv *ev, Window win)
+{
+    fb_client *c;
+
+    ENTER;
+    c = g_new0(fb_client, 1);
+    c->win = win;
+    c->ev = ev;
+    /* NOTE
+     * the event mask is sum of all plugins needs, see bug
+     * [ 940441 ] pager loose track of windows
+     *
+     * Do not change event mask to gtk windows spwaned by this gtk client
+     * this breaks gtk internals */
+    if (!FBPANEL_WIN(win))
+        XSelectInput(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), win,
+                PropertyChangeMask | StructureNotifyMask);
+    fb_xev_add(win, PropertyNotify, None,
+        (fb_xev_func) client_propertynotify, c);
+    fb_xev_add(win, ConfigureNotify, None,
+        (fb_xev_func) client_configurenotify, c);
+    RET(c);
+}
+
+static void
+client_free(fb_client *c)
+{
+    ENTER;
+    DBG("del %lx %s\n", c->win, c->name);
+    fb_xev_remove(c->win, PropertyNotify, None,
+        (fb_xev_func) client_propertynotify, c);
+    fb_xev_remove(c->win, ConfigureNotify, None,
+        (fb_xev_func) client_configurenotify, c);
+    client_free_class(c);
+    g_free(c->name);
+    g_free(c);
+    RET();
+}
+
+/* brings registry in sync with _NET_CLIENT_LIST. Gone windows are
+ * reported first, so plugins can release them before new ones arrive */
+static void
+ev_clients_sync(FbEv *ev)
+{
+    GHashTableIter iter;
+    GSList *stale = NULL;
+    fb_client *c, **added;
+    Window *wins;
+    int i, num, nadded;
+
+    ENTER;
+    if (!ev->clients)
+        ev->clients = g_hash_table_new(g_int_hash, g_int_equal);
+    wins = fb_ev_client_list(ev, &num);
+
+    ev->clients_mark++;
+    for (i = 0; i < num; i++)
+        if ((c = g_hash_table_lookup(ev->clients, &wins[i])))
+            c->mark = ev->clients_mark;
+
+    g_hash_table_iter_init(&iter, ev->clients);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &c)) {
+        if (c->mark != ev->clients_mark) {
+            g_hash_table_iter_remove(&iter);
+            stale = g_slist_prepend(stale, c);
+        }
+    }
+    for (; stale; stale = g_slist_delete_link(stale, stale)) {
+        c = stale->data;
+        if (c->pending)
+            ev->pending = g_slist_remove(ev->pending, c);
+        if (c->resync)
+            ev->resync = g_slist_remove(ev->resync, c);
+        g_signal_emit(ev, signals [EV_WINDOW_REMOVED], 0, c);
+        client_free(c);
+    }
+
+    added = g_new(fb_client *, num + 1);
+    for (nadded = i = 0; i < num; i++) {
+        if (g_hash_table_lookup(ev->clients, &wins[i]))
+            continue;
+        c = client_new(ev, wins[i]);
+        c->mark = ev->clients_mark;
+        g_hash_table_insert(ev->clients, &c->win, c);
+        added[nadded++] = c;
+    }
+    clients_fetch(added, nadded);
+    for (i = 0; i < nadded; i++)
+        g_signal_emit(ev, signals [EV_WINDOW_ADDED], 0, added[i]);
+    g_free(added);
+    RET();
+}
+
+static void
+client_emit_changed(FbEv *ev, fb_client *c, guint changed)
+{
+    ENTER;
+    DBG("win=%lx changed=%x\n", c->win, changed);
+    c->changed = changed;
+    g_signal_emit(ev, signals [EV_WINDOW_CHANGED], 0, c);
+    c->changed = 0;
+    RET();
+}
+
+/* Root positions that events did not tell are asked for all windows at
+ * once, in one round trip, and no more often than every
+ * GEOMETRY_RESYNC_MS. During a drag the pager follows window size from
+ * events and catches up with position a few times a second */
+#define GEOMETRY_RESYNC_MS 200
+
+static gboolean
+ev_clients_resync(FbEv *ev)
+{
+    xcb_connection_t *xc;
+    xcb_get_geometry_cookie_t *gcookies;
+    xcb_translate_coordinates_cookie_t *tcookies;
+    fb_client **cs, *c;
+    GSList *l;
+    const char *prev_event;
+    int i, n, x, y;
+    guint w, h;
+    gint64 ts;
+
+    ENTER;
+    prev_event = fb_xstat_set_event("geometry resync");
+    ev->resync_id = 0;
+    n = g_slist_length(ev->resync);
+    cs = g_new(fb_client *, n);
+    for (i = 0, l = ev->resync; l; l = l->next)
+        cs[i++] = l->data;
+    g_slist_free(ev->resync);
+    ev->resync = NULL;
+
+    xc = XGetXCBConnection(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()));
+    gcookies = g_new(xcb_get_geometry_cookie_t, n);
+    tcookies = g_new(xcb_translate_coordinates_cookie_t, n);
+    for (i = 0; i < n; i++) {
+        gcookies[i] = xcb_get_geometry(xc, cs[i]->win);
+        tcookies[i] = xcb_translate_coordinates(xc, cs[i]->win,
+            GDK_ROOT_WINDOW(), 0, 0);
+    }
+    ts = fb_xstat_begin();
+    for (i = 0; i < n; i++) {
+        c = cs[i];
+        c->resync = 0;
+        /* window may be gone already, its removal is on the way */
+        if (!client_geometry_reply(xc, gcookies[i], tcookies[i],
+                &x, &y, &w, &h))
+            continue;
+        if (x != c->x || y != c->y || w != c->w || h != c->h) {
+            c->x = x;
+            c->y = y;
+            c->w = w;
+            c->h = h;
+            client_emit_changed(ev, c, FB_CLIENT_GEOMETRY);
+        }
+    }
+    fb_xstat_end(ts, "GetGeometry resync", FB_XSTAT_HERE, 2 * n, 64 * n);
+    DBG("resynced %d windows\n", n);
+    g_free(tcookies);
+    g_free(gcookies);
+    g_free(cs);
+    fb_xstat_set_event(prev_event);
+    RET(FALSE);
+}
+
+static void
+client_queue_resync(FbEv *ev, fb_client *c)
+{
+    if (c->resync)
+        return;
+    c->resync = 1;
+    ev->resync = g_slist_prepend(ev->resync, c);
+    if (!ev->resync_id)
+        ev->resync_id = g_timeout_add(GEOMETRY_RESYNC_MS,
+            (GSourceFunc) ev_clients_resync, ev);
+}
+
+/* Takes geometry from latest ConfigureNotify instead of asking server.
+ * Size is always right there. Position is in root coordinates only in
+ * synthetic event that WM sends when it moves the frame (ICCCM 4.1.5);
+ * in real one it is relative to the frame, so it is left to resync */
+static void
+client_geometry_from_event(fb_client *c)
+{
+    c->w = c->ev_w;
+    c->h = c->ev_h;
+    if (c->ev_position) {
+        c->x = c->ev_x;
+        c->y = c->ev_y;
+    }
+    if (c->ev_relative)
+        client_queue_resync(c->ev, c);
+    c->ev_geometry = c->ev_position = c->ev_relative = 0;
+}
+
+/* refetches what is asked for and returns what has really changed */
+static guint
+client_refetch(fb_client *c, guint what)
+{
+    guint changed = 0;
+
+    ENTER;
+    if (what & FB_CLIENT_STATE) {
+        net_wm_state nws;
+
+        get_net_wm_state(c->win, &nws);
+        if (memcmp(&nws, &c->nws, sizeof(nws))) {
+            c->nws = nws;
+            changed |= FB_CLIENT_STATE;
+        }
+    }
+    if (what & FB_CLIENT_DESKTOP) {
+        guint desktop;
+
+        desktop = get_net_wm_desktop(c->win);
+        if (desktop != c->desktop) {
+            c->desktop = desktop;
+            changed |= FB_CLIENT_DESKTOP;
+        }
+    }
+    if (what & FB_CLIENT_NAME) {
+        gchar *name;
+
+        name = client_get_name(c->win);
+        if (g_strcmp0(name, c->name)) {
+            g_free(c->name);
+            c->name = name;
+            changed |= FB_CLIENT_NAME;
+        } else
+            g_free(name);
+    }
+    if (what & FB_CLIENT_TYPE) {
+        net_wm_window_type nwwt;
+
+        get_net_wm_window_type(c->win, &nwwt);
+        if (memcmp(&nwwt, &c->nwwt, sizeof(nwwt))) {
+            c->nwwt = nwwt;
+            changed |= FB_CLIENT_TYPE;
+        }
+    }
+    if (what & FB_CLIENT_CLASS) {
+        XClassHint ch = c->ch;
+
+        c->ch.res_name = c->ch.res_class = NULL;
+        client_get_class(c);
+        if (g_strcmp0(ch.res_name, c->ch.res_name)
+                || g_strcmp0(ch.res_class, c->ch.res_class))
+            changed |= FB_CLIENT_CLASS;
+        g_free(ch.res_name);
+        g_free(ch.res_class);
+    }
+    if (what & FB_CLIENT_HINTS) {
+        gboolean urgency = c->urgency;
+
+        client_get_hints(c);
+        /* icon may be redrawn into the same pixmap, so any write that
+         * carries one counts */
+        if (urgency != c->urgency || c->icon_pixmap != None)
+            changed |= FB_CLIENT_HINTS;
+    }
+    if (what & FB_CLIENT_ICON)
+        changed |= FB_CLIENT_ICON;
+    if (what & FB_CLIENT_GEOMETRY) {
+        int x = c->x, y = c->y;
+        guint w = c->w, h = c->h;
+
+        if (c->ev_geometry)
+            client_geometry_from_event(c);
+        else
+            client_get_geometry(c);
+        if (x != c->x || y != c->y || w != c->w || h != c->h)
+            changed |= FB_CLIENT_GEOMETRY;
+    }
+    RET(changed);
+}
+
+/* Pending updates are flushed once X event queue is drained, so a burst
+ * of events on the same window and property (title updates of a terminal,
+ * ConfigureNotify flood of a window drag) costs one refetch and one
+ * "window_changed" emission */
+static gboolean
+ev_clients_flush(FbEv *ev)
+{
+    GSList *pending;
+    fb_client *c;
+    guint what, changed;
+    int nclients = 0, nupdates = 0;
+    const char *prev_event;
+    fb_trace_stamp prev_stamp;
+
+    ENTER;
+    prev_event = fb_xstat_set_event("idle flush");
+    fb_trace_get(&prev_stamp);
+    fb_trace_set(&ev->flush_stamp);
+    pending = g_slist_reverse(ev->pending);
+    ev->pending = NULL;
+    ev->flush_id = 0;
+    for (; pending; pending = g_slist_delete_link(pending, pending)) {
+        c = pending->data;
+        what = c->pending;
+        c->pending = 0;
+        nclients++;
+        if ((changed = client_refetch(c, what))) {
+            client_emit_changed(ev, c, changed);
+            nupdates++;
+        }
+    }
+    ev->stats_flushes++;
+    ev->stats_windows += nclients;
+    ev->stats_updates += nupdates;
+    DBG("%d events -> %d windows, %d updates\n",
+        ev->burst_events, nclients, nupdates);
+    ev->burst_events = 0;
+    fb_xstat_set_event(prev_event);
+    fb_trace_set(&prev_stamp);
+    RET(FALSE);
+}
+
+static void
+client_queue(FbEv *ev, fb_client *c, guint what)
+{
+    ev->stats_events++;
+    ev->burst_events++;
+    if (!c->pending)
+        ev->pending = g_slist_prepend(ev->pending, c);
+    c->pending |= what;
+    if (!ev->flush_id) {
+        fb_trace_get(&ev->flush_stamp);
+        ev->flush_id = g_idle_add_full(G_PRIORITY_HIGH_IDLE,
+            (GSourceFunc) ev_clients_flush, ev, NULL);
+    }
+}
+
+static GdkFilterReturn
+client_propertynotify(XEvent *xev, fb_client *c)
+{
+    guint what;
+
+    if ((what = fb_atom_table_lookup(c->ev->client_atoms,
+                xev->xproperty.atom)))
+        client_queue(c->ev, c, what);
+    return GDK_FILTER_CONTINUE;
+}
+
+static GdkFilterReturn
+client_configurenotify(XEvent *xev, fb_client *c)
+{
+    XConfigureEvent *xce = &xev->xconfigure;
+
+    /* only the latest one of a burst is used, see client_refetch */
+    c->ev_w = xce->width;
+    c->ev_h = xce->height;
+    if (xce->send_event) {
+        c->ev_x = xce->x;
+        c->ev_y = xce->y;
+        c->ev_position = 1;
+    } else
+        c->ev_relative = 1;
+    c->ev_geometry = 1;
+    client_queue(c->ev, c, FB_CLIENT_GEOMETRY);
+    return GDK_FILTER_CONTINUE;
+}
+
+fb_client *
+fb_ev_client_lookup(FbEv *ev, Window win)
+{
+    ENTER;
+    if (!ev->clients)
+        ev_clients_sync(ev);
+    RET(g_hash_table_lookup(ev->clients, &win));
+}
+
+/* calls func for every managed window in _NET_CLIENT_LIST order */
+void
+fb_ev_client_foreach(FbEv *ev, GFunc func, gpointer data)
+{
+    fb_client *c;
+    Window *wins;
+    int i, num;
+
+    ENTER;
+    if (!ev->clients)
+        ev_clients_sync(ev);
+    wins = fb_ev_client_list(ev, &num);
+    for (i = 0; i < num; i++)
+        if ((c = g_hash_table_lookup(ev->clients, &wins[i])))
+            func(c, data);
+    RET();
+}
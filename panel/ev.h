@@ -35,6 +35,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <gtk/gtk.h>
+#include <X11/Xlib.h>
 
 #define FB_TYPE_EV         (fb_ev_get_type ())
 #define FB_EV(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o),      \
@@ -53,6 +54,7 @@
 
 typedef struct _FbEvClass FbEvClass;
 typedef struct _FbEv      FbEv;
+typedef struct _fb_client fb_client;
 enum {
     EV_CURRENT_DESKTOP,
     EV_NUMBER_OF_DESKTOPS,
@@ -60,9 +62,24 @@ enum {
     EV_ACTIVE_WINDOW,
     EV_CLIENT_LIST_STACKING,
     EV_CLIENT_LIST,
+    EV_WINDOW_ADDED,
+    EV_WINDOW_CHANGED,
+    EV_WINDOW_REMOVED,
     EV_LAST_SIGNAL
 };
 
+/* bits of fb_client.changed - what was updated by last "window_changed" */
+enum {
+    FB_CLIENT_STATE     = 1 << 0,
+    FB_CLIENT_TYPE      = 1 << 1,
+    FB_CLIENT_DESKTOP   = 1 << 2,
+    FB_CLIENT_GEOMETRY  = 1 << 3,
+    FB_CLIENT_NAME      = 1 << 4,
+    FB_CLIENT_CLASS     = 1 << 5,
+    FB_CLIENT_HINTS     = 1 << 6,
+    FB_CLIENT_ICON      = 1 << 7,
+};
+
 GType fb_ev_get_type       (void);
 FbEv *fb_ev_new(void);
 void fb_ev_notify_changed_ev(FbEv *ev);
@@ -71,9 +88,13 @@ void fb_ev_trigger(FbEv *ev, int signal);
 
 int fb_ev_current_desktop(FbEv *ev);
 int fb_ev_number_of_desktops(FbEv *ev);
+char **fb_ev_desktop_names(FbEv *ev, int *num);
 Window fb_ev_active_window(FbEv *ev);
-Window *fb_ev_client_list(FbEv *ev);
-Window *fb_ev_client_list_stacking(FbEv *ev);
+Window *fb_ev_client_list(FbEv *ev, int *num);
+Window *fb_ev_client_list_stacking(FbEv *ev, int *num);
+
+fb_client *fb_ev_client_lookup(FbEv *ev, Window win);
+void fb_ev_client_foreach(FbEv *ev, GFunc func, gpointer data);
 
 
 #endif /* __FB_EV_H__ */
@@ -27,6 +27,7 @@
 #include <string.h>
 #include "gtkbgbox.h"
 #include "bg.h"
+#include "xev.h"
 #include <gtk/gtkbin.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
@@ -47,6 +48,7 @@ typedef struct {
     int bg_type;
     FbBg *bg;
     gulong sid;
+    Window xwin;        /* window ConfigureNotify handler is set on */
 } GtkBgboxPrivate;
 
 
@@ -56,6 +58,7 @@ typedef struct {
 static void gtk_bgbox_class_init    (GtkBgboxClass *klass);
 static void gtk_bgbox_init          (GtkBgbox *bgbox);
 static void gtk_bgbox_realize       (GtkWidget *widget);
+static void gtk_bgbox_unrealize     (GtkWidget *widget);
 //static void gtk_bgbox_size_request  (GtkWidget *widget, GtkRequisition   *requisition);
 static void gtk_bgbox_size_allocate (GtkWidget *widget, GtkAllocation    *allocation);
 static void gtk_bgbox_style_set (GtkWidget *widget, GtkStyle  *previous_style);
@@ -110,6 +113,7 @@ gtk_bgbox_class_init (GtkBgboxClass *class)
     parent_class = g_type_class_peek_parent (class);
 
     widget_class->realize         = gtk_bgbox_realize;
+    widget_class->unrealize       = gtk_bgbox_unrealize;
 //    widget_class->size_request    = gtk_bgbox_size_request;
     gtk_widget_get_preferred_size((GtkWidget*)widget_class, NULL, &nat);
     widget_class->size_allocate   = gtk_bgbox_size_allocate;
@@ -134,6 +138,7 @@ gtk_bgbox_init (GtkBgbox *bgbox)
     priv = GTK_BGBOX_GET_PRIVATE (bgbox);
     priv->bg_type = BG_NONE;
     priv->sid = 0;
+    priv->xwin = None;
     RET();
 }
 
@@ -167,21 +172,17 @@ gtk_bgbox_finalize (GObject *object)
 }
 
 static GdkFilterReturn
-gtk_bgbox_event_filter(GdkXEvent *xevent, GdkEvent *event, GtkWidget *widget)
+gtk_bgbox_event_filter(XEvent *ev, GtkWidget *widget)
 {
-    XEvent *ev = (XEvent *) xevent;
-
     ENTER;
-    if (ev->type == ConfigureNotify) {
-        gtk_widget_queue_draw(widget);
-        //gtk_bgbox_style_set(widget, NULL);
-        DBG("ConfigureNotify %d %d %d %d\n",
-              ev->xconfigure.x,
-              ev->xconfigure.y,
-              ev->xconfigure.width,
-              ev->xconfigure.height
-            );
-    }
+    gtk_widget_queue_draw(widget);
+    //gtk_bgbox_style_set(widget, NULL);
+    DBG("ConfigureNotify %d %d %d %d\n",
+          ev->xconfigure.x,
+          ev->xconfigure.y,
+          ev->xconfigure.width,
+          ev->xconfigure.height
+        );
     RET(GDK_FILTER_CONTINUE);
 }
 
@@ -240,8 +241,28 @@ gtk_bgbox_realize (GtkWidget *widget)
     if (priv->bg_type == BG_NONE)
         gtk_bgbox_set_background(widget, BG_STYLE, 0, 0);
 
-    gdk_window_add_filter(gtk_widget_get_window(widget), (GdkFilterFunc) gtk_bgbox_event_filter, widget);
+    if (gtk_widget_get_window(widget)) {
+        priv->xwin = GDK_WINDOW_XID(gtk_widget_get_window(widget));
+        fb_xev_add(priv->xwin, ConfigureNotify, None,
+            (fb_xev_func) gtk_bgbox_event_filter, widget);
+    }
+
+    RET();
+}
+
+static void
+gtk_bgbox_unrealize (GtkWidget *widget)
+{
+    GtkBgboxPrivate *priv;
 
+    ENTER;
+    priv = GTK_BGBOX_GET_PRIVATE (widget);
+    if (priv->xwin) {
+        fb_xev_remove(priv->xwin, ConfigureNotify, None,
+            (fb_xev_func) gtk_bgbox_event_filter, widget);
+        priv->xwin = None;
+    }
+    GTK_WIDGET_CLASS (parent_class)->unrealize (widget);
     RET();
 }
 
@@ -0,0 +1,150 @@
+/*
+ * Shared icon cache.
+ *
+ * Many windows of one application carry identical icons. Decoding and
+ * scaling them once and sharing the pixbuf saves both time and memory.
+ */
+
+#include <glib.h>
+#include <glib-object.h>
+#include <string.h>
+
+#include "iconcache.h"
+#include "xstat.h"
+
+//#define DEBUGPRN
+#include "dbg.h"
+
+typedef struct {
+    /* key */
+    char *res_class;
+    guint64 hash;
+    int w, h;
+    /* value, not referenced */
+    GdkPixbuf *pixbuf;
+} icon_entry;
+
+static GHashTable *icons;
+static gulong hits, misses;
+
+static guint
+icon_entry_hash(gconstpointer key)
+{
+    const icon_entry *e = key;
+
+    return g_str_hash(e->res_class) ^ (guint) e->hash
+        ^ (guint) (e->hash >> 32) ^ ((guint) e->w << 16) ^ (guint) e->h;
+}
+
+static gboolean
+icon_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const icon_entry *e1 = a, *e2 = b;
+
+    return e1->hash == e2->hash && e1->w == e2->w && e1->h == e2->h
+        && !strcmp(e1->res_class, e2->res_class);
+}
+
+static void
+icon_entry_free(icon_entry *e)
+{
+    g_free(e->res_class);
+    g_free(e);
+}
+
+/* last user of pixbuf is gone */
+static void
+icon_cache_gone(gpointer data, GObject *obj)
+{
+    ENTER;
+    DBG("drop %s %dx%d\n", ((icon_entry *) data)->res_class,
+        ((icon_entry *) data)->w, ((icon_entry *) data)->h);
+    g_hash_table_remove(icons, data);
+    RET();
+}
+
+static void
+icon_cache_init(void)
+{
+    icons = g_hash_table_new_full(icon_entry_hash, icon_entry_equal,
+        (GDestroyNotify) icon_entry_free, NULL);
+    fb_xstat_add_counter("icon cache hits", &hits);
+    fb_xstat_add_counter("icon cache misses", &misses);
+}
+
+/* FNV-1a over pixels, seeded with dimensions */
+guint64
+fb_icon_hash(const gulong *data, int w, int h)
+{
+    guint64 hash = 14695981039346656037ULL;
+    int i;
+
+    hash = (hash ^ (guint32) w) * 1099511628211ULL;
+    hash = (hash ^ (guint32) h) * 1099511628211ULL;
+    for (i = 0; i < w * h; i++)
+        hash = (hash ^ (guint32) data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/* same hash, over pixmap ids with a distinct seed so that the two kinds
+ * of key do not mix */
+guint64
+fb_icon_hash_xid(gulong pixmap, gulong mask)
+{
+    guint64 hash = 0x84222325cbf29ce4ULL;
+
+    hash = (hash ^ (guint32) pixmap) * 1099511628211ULL;
+    hash = (hash ^ (guint32) mask) * 1099511628211ULL;
+    return hash;
+}
+
+GdkPixbuf *
+fb_icon_cache_get(const char *res_class, guint64 hash, int w, int h)
+{
+    icon_entry key, *e;
+
+    ENTER;
+    if (!icons)
+        icon_cache_init();
+    key.res_class = (char *) (res_class ? res_class : "");
+    key.hash = hash;
+    key.w = w;
+    key.h = h;
+    if (!(e = g_hash_table_lookup(icons, &key))) {
+        misses++;
+        RET(NULL);
+    }
+    hits++;
+    RET(g_object_ref(e->pixbuf));
+}
+
+void
+fb_icon_cache_put(const char *res_class, guint64 hash, int w, int h,
+    GdkPixbuf *pixbuf)
+{
+    icon_entry *e;
+
+    ENTER;
+    if (!icons)
+        icon_cache_init();
+    e = g_new(icon_entry, 1);
+    e->res_class = g_strdup(res_class ? res_class : "");
+    e->hash = hash;
+    e->w = w;
+    e->h = h;
+    if (g_hash_table_contains(icons, e)) {
+        icon_entry_free(e);
+        RET();
+    }
+    e->pixbuf = pixbuf;
+    g_object_weak_ref(G_OBJECT(pixbuf), icon_cache_gone, e);
+    g_hash_table_add(icons, e);
+    RET();
+}
+
+void
+fb_icon_cache_stats(gulong *hits_ret, gulong *misses_ret)
+{
+    *hits_ret = hits;
+    *misses_ret = misses;
+}
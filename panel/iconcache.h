@@ -0,0 +1,26 @@
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Decoded and scaled window icons shared between tasks and plugins.
+ * Entry is keyed by window class, hash of source icon and target
+ * size. Cache holds no reference of its own: entry is dropped when last
+ * user unrefs its pixbuf. Hits and misses are counted in X stats */
+
+/* hash of w x h ARGB icon as read from _NET_WM_ICON */
+guint64 fb_icon_hash(const gulong *data, int w, int h);
+/* hash of WM_HINTS icon pixmap and mask ids */
+guint64 fb_icon_hash_xid(gulong pixmap, gulong mask);
+
+/* returns new reference to cached pixbuf, or NULL */
+GdkPixbuf *fb_icon_cache_get(const char *res_class, guint64 hash,
+    int w, int h);
+/* makes pixbuf available to later fb_icon_cache_get calls */
+void fb_icon_cache_put(const char *res_class, guint64 hash, int w, int h,
+    GdkPixbuf *pixbuf);
+
+void fb_icon_cache_stats(gulong *hits, gulong *misses);
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
 
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
@@ -16,6 +18,7 @@
 
 #include "misc.h"
 #include "gtkbgbox.h"
+#include "pixconv.h"
 
 //#define DEBUGPRN
 #include "dbg.h"
@@ -63,7 +66,6 @@ Atom a_NET_WM_WINDOW_TYPE_UTILITY;
 Atom a_NET_WM_WINDOW_TYPE_SPLASH;
 Atom a_NET_WM_WINDOW_TYPE_DIALOG;
 Atom a_NET_WM_WINDOW_TYPE_NORMAL;
-Atom a_NET_WM_DESKTOP;
 Atom a_NET_WM_NAME;
 Atom a_NET_WM_VISIBLE_NAME;
 Atom a_NET_WM_STRUT;
@@ -135,53 +137,107 @@ num2str(xconf_enum *p, int num, gchar *defval)
 }
 
 
-void resolve_atoms()
+/* atoms interned at startup */
+static fb_atom core_atoms[] = {
+    { &a_UTF8_STRING,                        "UTF8_STRING" },
+    { &a_XROOTPMAP_ID,                       "_XROOTPMAP_ID" },
+    { &a_WM_STATE,                           "WM_STATE" },
+    { &a_WM_CLASS,                           "WM_CLASS" },
+    { &a_WM_DELETE_WINDOW,                   "WM_DELETE_WINDOW" },
+    { &a_WM_PROTOCOLS,                       "WM_PROTOCOLS" },
+    { &a_NET_WORKAREA,                       "_NET_WORKAREA" },
+    { &a_NET_CLIENT_LIST,                    "_NET_CLIENT_LIST" },
+    { &a_NET_CLIENT_LIST_STACKING,           "_NET_CLIENT_LIST_STACKING" },
+    { &a_NET_NUMBER_OF_DESKTOPS,             "_NET_NUMBER_OF_DESKTOPS" },
+    { &a_NET_CURRENT_DESKTOP,                "_NET_CURRENT_DESKTOP" },
+    { &a_NET_DESKTOP_NAMES,                  "_NET_DESKTOP_NAMES" },
+    { &a_NET_DESKTOP_GEOMETRY,               "_NET_DESKTOP_GEOMETRY" },
+    { &a_NET_ACTIVE_WINDOW,                  "_NET_ACTIVE_WINDOW" },
+    { &a_NET_CLOSE_WINDOW,                   "_NET_CLOSE_WINDOW" },
+    { &a_NET_SUPPORTED,                      "_NET_SUPPORTED" },
+    { &a_NET_WM_DESKTOP,                     "_NET_WM_DESKTOP" },
+    { &a_NET_WM_STATE,                       "_NET_WM_STATE" },
+    { &a_NET_WM_STATE_SKIP_TASKBAR,          "_NET_WM_STATE_SKIP_TASKBAR" },
+    { &a_NET_WM_STATE_SKIP_PAGER,            "_NET_WM_STATE_SKIP_PAGER" },
+    { &a_NET_WM_STATE_STICKY,                "_NET_WM_STATE_STICKY" },
+    { &a_NET_WM_STATE_HIDDEN,                "_NET_WM_STATE_HIDDEN" },
+    { &a_NET_WM_STATE_SHADED,                "_NET_WM_STATE_SHADED" },
+    { &a_NET_WM_STATE_ABOVE,                 "_NET_WM_STATE_ABOVE" },
+    { &a_NET_WM_STATE_BELOW,                 "_NET_WM_STATE_BELOW" },
+    { &a_NET_WM_WINDOW_TYPE,                 "_NET_WM_WINDOW_TYPE" },
+    { &a_NET_WM_WINDOW_TYPE_DESKTOP,         "_NET_WM_WINDOW_TYPE_DESKTOP" },
+    { &a_NET_WM_WINDOW_TYPE_DOCK,            "_NET_WM_WINDOW_TYPE_DOCK" },
+    { &a_NET_WM_WINDOW_TYPE_TOOLBAR,         "_NET_WM_WINDOW_TYPE_TOOLBAR" },
+    { &a_NET_WM_WINDOW_TYPE_MENU,            "_NET_WM_WINDOW_TYPE_MENU" },
+    { &a_NET_WM_WINDOW_TYPE_UTILITY,         "_NET_WM_WINDOW_TYPE_UTILITY" },
+    { &a_NET_WM_WINDOW_TYPE_SPLASH,          "_NET_WM_WINDOW_TYPE_SPLASH" },
+    { &a_NET_WM_WINDOW_TYPE_DIALOG,          "_NET_WM_WINDOW_TYPE_DIALOG" },
+    { &a_NET_WM_WINDOW_TYPE_NORMAL,          "_NET_WM_WINDOW_TYPE_NORMAL" },
+    { &a_NET_WM_NAME,                        "_NET_WM_NAME" },
+    { &a_NET_WM_VISIBLE_NAME,                "_NET_WM_VISIBLE_NAME" },
+    { &a_NET_WM_STRUT,                       "_NET_WM_STRUT" },
+    { &a_NET_WM_STRUT_PARTIAL,               "_NET_WM_STRUT_PARTIAL" },
+    { &a_NET_WM_ICON,                        "_NET_WM_ICON" },
+    { &a_KDE_NET_WM_SYSTEM_TRAY_WINDOW_FOR,  "_KDE_NET_WM_SYSTEM_TRAY_WINDOW_FOR" },
+    { NULL, NULL }
+};
+
+/* atom tables waiting for fb_atoms_resolve */
+static GPtrArray *atoms_pending;
+
+/* Queues NULL-terminated atom table for interning. Nothing is sent to X
+ * server until fb_atoms_resolve, so tables added before it share one
+ * request */
+void
+fb_atoms_add(fb_atom *atoms)
 {
     ENTER;
+    if (!atoms_pending)
+        atoms_pending = g_ptr_array_new();
+    g_ptr_array_add(atoms_pending, atoms);
+    RET();
+}
+
+/* interns all queued atoms with one XInternAtoms round trip */
+void
+fb_atoms_resolve(void)
+{
+    fb_atom *a;
+    char **names;
+    Atom *ret;
+    guint i;
+    int n;
 
-    a_UTF8_STRING                = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "UTF8_STRING", False);
-    a_XROOTPMAP_ID               = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_XROOTPMAP_ID", False);
-    a_WM_STATE                   = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "WM_STATE", False);
-    a_WM_CLASS                   = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "WM_CLASS", False);
-    a_WM_DELETE_WINDOW           = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "WM_DELETE_WINDOW", False);
-    a_WM_PROTOCOLS               = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "WM_PROTOCOLS", False);
-    a_NET_WORKAREA               = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WORKAREA", False);
-    a_NET_CLIENT_LIST            = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_CLIENT_LIST", False);
-    a_NET_CLIENT_LIST_STACKING   = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_CLIENT_LIST_STACKING", False);
-    a_NET_NUMBER_OF_DESKTOPS     = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_NUMBER_OF_DESKTOPS", False);
-    a_NET_CURRENT_DESKTOP        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_CURRENT_DESKTOP", False);
-    a_NET_DESKTOP_NAMES          = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_DESKTOP_NAMES", False);
-    a_NET_DESKTOP_GEOMETRY       = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_DESKTOP_GEOMETRY", False);
-    a_NET_ACTIVE_WINDOW          = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_ACTIVE_WINDOW", False);
-    a_NET_SUPPORTED              = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_SUPPORTED", False);
-    a_NET_WM_DESKTOP             = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_DESKTOP", False);
-    a_NET_WM_STATE               = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE", False);
-    a_NET_WM_STATE_SKIP_TASKBAR  = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_SKIP_TASKBAR", False);
-    a_NET_WM_STATE_SKIP_PAGER    = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_SKIP_PAGER", False);
-    a_NET_WM_STATE_STICKY        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_STICKY", False);
-    a_NET_WM_STATE_HIDDEN        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_HIDDEN", False);
-    a_NET_WM_STATE_SHADED        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_SHADED", False);
-    a_NET_WM_STATE_ABOVE         = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_ABOVE", False);
-    a_NET_WM_STATE_BELOW         = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_BELOW", False);
-    a_NET_WM_STATE_SHADED        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STATE_SHADED", False);
-    a_NET_WM_WINDOW_TYPE         = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE", False);
-
-    a_NET_WM_WINDOW_TYPE_DESKTOP = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_DESKTOP", False);
-    a_NET_WM_WINDOW_TYPE_DOCK    = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_DOCK", False);
-    a_NET_WM_WINDOW_TYPE_TOOLBAR = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_TOOLBAR", False);
-    a_NET_WM_WINDOW_TYPE_MENU    = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_MENU", False);
-    a_NET_WM_WINDOW_TYPE_UTILITY = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_UTILITY", False);
-    a_NET_WM_WINDOW_TYPE_SPLASH  = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_SPLASH", False);
-    a_NET_WM_WINDOW_TYPE_DIALOG  = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_DIALOG", False);
-    a_NET_WM_WINDOW_TYPE_NORMAL  = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_WINDOW_TYPE_NORMAL", False);
-    a_NET_WM_DESKTOP             = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_DESKTOP", False);
-    a_NET_WM_NAME                = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_NAME", False);
-    a_NET_WM_VISIBLE_NAME        = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_VISIBLE_NAME", False);
-    a_NET_WM_STRUT               = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STRUT", False);
-    a_NET_WM_STRUT_PARTIAL       = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_STRUT_PARTIAL", False);
-    a_NET_WM_ICON                = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_NET_WM_ICON", False);
-    a_KDE_NET_WM_SYSTEM_TRAY_WINDOW_FOR = XInternAtom(gdk_x11_display_get_xdisplay(gdk_display_get_default()), "_KDE_NET_WM_SYSTEM_TRAY_WINDOW_FOR", False);
+    ENTER;
+    if (!atoms_pending || !atoms_pending->len)
+        RET();
+    for (n = 0, i = 0; i < atoms_pending->len; i++)
+        for (a = g_ptr_array_index(atoms_pending, i); a->name; a++)
+            n++;
+    names = g_new(char *, n);
+    ret = g_new0(Atom, n);
+    for (n = 0, i = 0; i < atoms_pending->len; i++)
+        for (a = g_ptr_array_index(atoms_pending, i); a->name; a++)
+            names[n++] = (char *) a->name;
+    if (!XInternAtoms(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
+            names, n, False, ret))
+        ERR("failed to intern some of %d atoms\n", n);
+    for (n = 0, i = 0; i < atoms_pending->len; i++)
+        for (a = g_ptr_array_index(atoms_pending, i); a->name; a++)
+            *a->atom = ret[n++];
+    DBG("interned %d atoms\n", n);
+    g_ptr_array_set_size(atoms_pending, 0);
+    g_free(names);
+    g_free(ret);
+    RET();
+}
 
+static void
+resolve_atoms()
+{
+    ENTER;
+    fb_atoms_add(core_atoms);
+    fb_atoms_resolve();
     RET();
 }
 
@@ -235,7 +291,8 @@ Xclimsgwm(Window win, Atom type, Atom arg)
 
 
 void *
-get_utf8_property(Window win, Atom atom)
+get_utf8_property_at(const char *file, const char *func, Window win,
+    Atom atom)
 {
 
     Atom type;
@@ -245,12 +302,16 @@ get_utf8_property(Window win, Atom atom)
     gchar  *retval;
     int result;
     guchar *tmp = NULL;
+    gint64 t;
 
     type = None;
     retval = NULL;
+    t = fb_xstat_begin();
     result = XGetWindowProperty (gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, atom, 0, G_MAXLONG, False,
           a_UTF8_STRING, &type, &format, &nitems,
           &bytes_after, &tmp);
+    fb_xstat_end(t, "GetProperty", file, func, 1,
+        result == Success ? FB_XSTAT_PROP_BYTES(nitems, format) : 0);
     if (result != Success)
         return NULL;
     if (tmp) {
@@ -263,7 +324,8 @@ get_utf8_property(Window win, Atom atom)
 }
 
 char **
-get_utf8_property_list(Window win, Atom atom, int *count)
+get_utf8_property_list_at(const char *file, const char *func, Window win,
+    Atom atom, int *count)
 {
     Atom type;
     int format, i;
@@ -272,11 +334,15 @@ get_utf8_property_list(Window win, Atom atom, int *count)
     gchar *s, **retval = NULL;
     int result;
     guchar *tmp = NULL;
+    gint64 t;
 
     *count = 0;
+    t = fb_xstat_begin();
     result = XGetWindowProperty(gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, atom, 0, G_MAXLONG, False,
           a_UTF8_STRING, &type, &format, &nitems,
           &bytes_after, &tmp);
+    fb_xstat_end(t, "GetProperty", file, func, 1,
+        result == Success ? FB_XSTAT_PROP_BYTES(nitems, format) : 0);
     if (result != Success || type != a_UTF8_STRING || tmp == NULL)
         return NULL;
 
@@ -307,8 +373,9 @@ get_utf8_property_list(Window win, Atom atom, int *count)
 
 }
 
-void *
-get_xaproperty (Window win, Atom prop, Atom type, int *nitems)
+static void *
+xaproperty_read(Window win, Atom prop, Atom type, long offset,
+    long length, int *nitems, gulong *after, gulong *bytes)
 {
     Atom type_ret;
     int format_ret;
@@ -318,18 +385,97 @@ get_xaproperty (Window win, Atom prop, Atom type, int *nitems)
 
     ENTER;
     prop_data = NULL;
-    if (XGetWindowProperty (gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, prop, 0, 0x7fffffff, False,
+    *bytes = 0;
+    if (XGetWindowProperty (gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, prop, offset, length, False,
               type, &type_ret, &format_ret, &items_ret,
               &after_ret, &prop_data) != Success)
         RET(NULL);
     DBG("win=%x prop=%d type=%d rtype=%d rformat=%d nitems=%d\n", win, prop,
             type, type_ret, format_ret, items_ret);
-
+    *bytes = FB_XSTAT_PROP_BYTES(items_ret, format_ret);
     if (nitems)
         *nitems = items_ret;
+    if (after)
+        *after = after_ret;
     RET(prop_data);
 }
 
+void *
+get_xaproperty_at(const char *file, const char *func, Window win,
+    Atom prop, Atom type, int *nitems)
+{
+    void *ret;
+    gulong bytes;
+    gint64 t;
+
+    ENTER;
+    t = fb_xstat_begin();
+    ret = xaproperty_read(win, prop, type, 0, 0x7fffffff, nitems, NULL,
+        &bytes);
+    fb_xstat_end(t, "GetProperty", file, func, 1, bytes);
+    RET(ret);
+}
+
+/* Windowed read: fetches at most length items starting at item offset.
+ * Offset and length are in 32-bit units as in XGetWindowProperty, which
+ * equals items for format 32 properties. If after is not NULL it is set
+ * to the number of bytes left past the window. Returns NULL if property
+ * is missing or not of given type; result must be freed with XFree */
+void *
+get_xaproperty_range_at(const char *file, const char *func, Window win,
+    Atom prop, Atom type, long offset, long length, int *nitems,
+    gulong *after)
+{
+    void *ret;
+    gulong bytes;
+    gint64 t;
+
+    ENTER;
+    t = fb_xstat_begin();
+    ret = xaproperty_read(win, prop, type, offset, length, nitems, after,
+        &bytes);
+    fb_xstat_end(t, "GetProperty range", file, func, 1, bytes);
+    RET(ret);
+}
+
+/* Probe: asks for zero items, so no property data is transferred.
+ * Returns TRUE if property is set and is of given type (any type if
+ * AnyPropertyType), and stores its format and full size in items */
+gboolean
+get_xaproperty_info_at(const char *file, const char *func, Window win,
+    Atom prop, Atom type, int *format, gulong *nitems)
+{
+    Atom type_ret;
+    int format_ret;
+    unsigned long items_ret;
+    unsigned long after_ret;
+    unsigned char *prop_data = NULL;
+    int result;
+    gint64 t;
+
+    ENTER;
+    t = fb_xstat_begin();
+    result = XGetWindowProperty (gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, prop, 0, 0, False,
+              type, &type_ret, &format_ret, &items_ret,
+              &after_ret, &prop_data);
+    fb_xstat_end(t, "GetProperty probe", file, func, 1, 32);
+    if (result != Success)
+        RET(FALSE);
+    if (prop_data)
+        XFree(prop_data);
+    DBG("win=%lx prop=%ld rtype=%ld rformat=%d size=%lu\n", win, prop,
+        type_ret, format_ret, after_ret);
+    if (type_ret == None || format_ret == 0)
+        RET(FALSE);
+    if (type != AnyPropertyType && type_ret != type)
+        RET(FALSE);
+    if (format)
+        *format = format_ret;
+    if (nitems)
+        *nitems = after_ret / (format_ret / 8);
+    RET(TRUE);
+}
+
 static char*
 text_property_to_utf8 (const XTextProperty *prop)
 {
@@ -358,14 +504,123 @@ text_property_to_utf8 (const XTextProperty *prop)
   RET(retval);
 }
 
+/* Batched variant of get_xaproperty. Requests for all nwins x nprops
+ * (window, property) pairs are sent at once, and replies are collected
+ * afterwards, so it costs one round trip instead of nwins * nprops.
+ * types may be NULL to accept any type. Result is indexed as
+ * [win * nprops + prop]; format 32 data is converted to longs, like Xlib
+ * does, and format 8 data is zero terminated. Free it with
+ * xaprop_batch_free */
+xaprop *
+get_xaproperty_batch_at(const char *file, const char *func, Window *wins,
+    int nwins, Atom *props, Atom *types, int nprops)
+{
+    xcb_connection_t *xc;
+    xcb_get_property_cookie_t *cookies;
+    xcb_get_property_reply_t *r;
+    xcb_generic_error_t *err;
+    xaprop *ret;
+    int i, j, n, len;
+    gulong bytes = 0;
+    gint64 t;
+
+    ENTER;
+    n = nwins * nprops;
+    if (n <= 0)
+        RET(NULL);
+    t = fb_xstat_begin();
+    xc = XGetXCBConnection(gdk_x11_display_get_xdisplay(gdk_display_get_default()));
+    cookies = g_new(xcb_get_property_cookie_t, n);
+    for (i = 0; i < n; i++)
+        cookies[i] = xcb_get_property(xc, 0, wins[i / nprops],
+            props[i % nprops],
+            types ? types[i % nprops] : XCB_GET_PROPERTY_TYPE_ANY,
+            0, 0x7fffffff);
+
+    ret = g_new0(xaprop, n);
+    for (i = 0; i < n; i++) {
+        err = NULL;
+        r = xcb_get_property_reply(xc, cookies[i], &err);
+        if (err) {
+            DBG("win=%lx prop=%ld error=%d\n", wins[i / nprops],
+                props[i % nprops], err->error_code);
+            free(err);
+        }
+        if (!r)
+            continue;
+        bytes += 32 + 4 * r->length;
+        ret[i].type = r->type;
+        ret[i].format = r->format;
+        len = xcb_get_property_value_length(r);
+        if (r->type != XCB_NONE && len > 0) {
+            ret[i].nitems = r->value_len;
+            if (r->format == 32) {
+                uint32_t *src = xcb_get_property_value(r);
+                gulong *dst = g_new(gulong, r->value_len);
+
+                for (j = 0; j < r->value_len; j++)
+                    dst[j] = src[j];
+                ret[i].data = dst;
+            } else {
+                ret[i].data = g_malloc(len + 1);
+                memcpy(ret[i].data, xcb_get_property_value(r), len);
+                ((gchar *) ret[i].data)[len] = 0;
+            }
+        }
+        free(r);
+    }
+    g_free(cookies);
+    fb_xstat_end(t, "GetProperty batch", file, func, n, bytes);
+    RET(ret);
+}
+
+void
+xaprop_batch_free(xaprop *props, int n)
+{
+    int i;
+
+    ENTER;
+    if (!props)
+        RET();
+    for (i = 0; i < n; i++)
+        g_free(props[i].data);
+    g_free(props);
+    RET();
+}
+
+/* converts text property fetched by get_xaproperty_batch to utf8 */
+char *
+xaprop_to_utf8(xaprop *prop)
+{
+    XTextProperty text_prop;
+
+    ENTER;
+    if (!prop->data || !prop->nitems)
+        RET(NULL);
+    if (prop->type == a_UTF8_STRING && prop->format == 8)
+        RET(g_strndup(prop->data, prop->nitems));
+    text_prop.value = prop->data;
+    text_prop.encoding = prop->type;
+    text_prop.format = prop->format;
+    text_prop.nitems = prop->nitems;
+    RET(text_property_to_utf8(&text_prop));
+}
+
 char *
-get_textproperty(Window win, Atom atom)
+get_textproperty_at(const char *file, const char *func, Window win,
+    Atom atom)
 {
     XTextProperty text_prop;
     char *retval;
+    Status ok;
+    gint64 t;
 
     ENTER;
-    if (XGetTextProperty(gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, &text_prop, atom)) {
+    t = fb_xstat_begin();
+    ok = XGetTextProperty(gdk_x11_display_get_xdisplay(gdk_display_get_default()), win, &text_prop, atom);
+    fb_xstat_end(t, "GetProperty", file, func, 1,
+        ok ? FB_XSTAT_PROP_BYTES(text_prop.nitems, text_prop.format) : 32);
+    if (ok) {
         DBG("format=%d enc=%d nitems=%d value=%s   \n",
               text_prop.format,
               text_prop.encoding,
@@ -380,6 +635,22 @@ get_textproperty(Window win, Atom atom)
     RET(NULL);
 }
 
+/* XGetWMHints with accounting; free result with XFree */
+XWMHints *
+get_wm_hints_at(const char *file, const char *func, Window win)
+{
+    XWMHints *hints;
+    gint64 t;
+
+    ENTER;
+    t = fb_xstat_begin();
+    hints = XGetWMHints(gdk_x11_display_get_xdisplay(gdk_display_get_default()), win);
+    /* WM_HINTS is 9 CARD32 */
+    fb_xstat_end(t, "GetProperty", file, func, 1,
+        FB_XSTAT_PROP_BYTES(hints ? 9 : 0, 32));
+    RET(hints);
+}
+
 
 guint
 get_net_number_of_desktops()
@@ -443,7 +714,18 @@ get_net_wm_state(Window win, net_wm_state *nws)
     if (!(state = get_xaproperty(win, a_NET_WM_STATE, XA_ATOM, &num3)))
         RET();
 
-    DBG( "%x: netwm state = { ", (unsigned int)win);
+    DBG( "%x: ", (unsigned int)win);
+    parse_net_wm_state(state, num3, nws);
+    XFree(state);
+    RET();
+}
+
+void
+parse_net_wm_state(Atom *state, int num3, net_wm_state *nws)
+{
+    ENTER;
+    bzero(nws, sizeof(*nws));
+    DBG( "netwm state = { ");
     while (--num3 >= 0) {
         if (state[num3] == a_NET_WM_STATE_SKIP_PAGER) {
             DBGE("NET_WM_STATE_SKIP_PAGER ");
@@ -464,7 +746,6 @@ get_net_wm_state(Window win, net_wm_state *nws)
             DBGE("... ");
         }
     }
-    XFree(state);
     DBGE( "}\n");
     RET();
 }
@@ -484,7 +765,18 @@ get_net_wm_window_type(Window win, net_wm_window_type *nwwt)
     if (!(state = get_xaproperty(win, a_NET_WM_WINDOW_TYPE, XA_ATOM, &num3)))
         RET();
 
-    DBG( "%x: netwm state = { ", (unsigned int)win);
+    DBG( "%x: ", (unsigned int)win);
+    parse_net_wm_window_type(state, num3, nwwt);
+    XFree(state);
+    RET();
+}
+
+void
+parse_net_wm_window_type(Atom *state, int num3, net_wm_window_type *nwwt)
+{
+    ENTER;
+    bzero(nwwt, sizeof(*nwwt));
+    DBG( "netwm window type = { ");
     while (--num3 >= 0) {
         if (state[num3] == a_NET_WM_WINDOW_TYPE_DESKTOP) {
             DBG("NET_WM_WINDOW_TYPE_DESKTOP ");
@@ -514,7 +806,6 @@ get_net_wm_window_type(Window win, net_wm_window_type *nwwt)
             DBG( "... ");
         }
     }
-    XFree(state);
     DBG( "}\n");
     RET();
 }
@@ -870,7 +1161,7 @@ fb_pixbuf_make_press_image(GdkPixbuf *front)
     w = gdk_pixbuf_get_width(front) - 2 * PRESS_GAP;
     h = gdk_pixbuf_get_height(front) - 2 * PRESS_GAP;
     press = gdk_pixbuf_copy(front);
-    tmp = gdk_pixbuf_scale_simple(front, w, h, GDK_INTERP_HYPER);
+    tmp = fb_pixbuf_scale(front, w, h);
     if (press && tmp) {
         gdk_pixbuf_fill(press, 0);
         gdk_pixbuf_copy_area(tmp,
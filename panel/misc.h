@@ -8,6 +8,7 @@
 #include <stdio.h>
 
 #include "panel.h"
+#include "xstat.h"
 
 int str2num(xconf_enum *p, gchar *str, int defval);
 gchar *num2str(xconf_enum *p, int num, gchar *defval);
@@ -15,19 +16,62 @@ gchar *num2str(xconf_enum *p, int num, gchar *defval);
 
 void Xclimsg(Window win, long type, long l0, long l1, long l2, long l3, long l4);
 void Xclimsgwm(Window win, Atom type, Atom arg);
-void *get_xaproperty (Window win, Atom prop, Atom type, int *nitems);
-char *get_textproperty(Window win, Atom prop);
-void *get_utf8_property(Window win, Atom atom);
-char **get_utf8_property_list(Window win, Atom atom, int *count);
+
+/* Property readers are accounted in X traffic statistics (see xstat.h)
+ * under the caller's name, hence the macros */
+#define get_xaproperty(...) get_xaproperty_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_xaproperty_range(...) \
+    get_xaproperty_range_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_xaproperty_info(...) \
+    get_xaproperty_info_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_xaproperty_batch(...) \
+    get_xaproperty_batch_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_textproperty(...) get_textproperty_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_utf8_property(...) \
+    get_utf8_property_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_utf8_property_list(...) \
+    get_utf8_property_list_at(FB_XSTAT_HERE, __VA_ARGS__)
+#define get_wm_hints(...) get_wm_hints_at(FB_XSTAT_HERE, __VA_ARGS__)
+
+void *get_xaproperty_at(const char *file, const char *func, Window win,
+    Atom prop, Atom type, int *nitems);
+void *get_xaproperty_range_at(const char *file, const char *func,
+    Window win, Atom prop, Atom type, long offset, long length,
+    int *nitems, gulong *after);
+gboolean get_xaproperty_info_at(const char *file, const char *func,
+    Window win, Atom prop, Atom type, int *format, gulong *nitems);
+XWMHints *get_wm_hints_at(const char *file, const char *func, Window win);
+
+/* one property value returned by get_xaproperty_batch */
+typedef struct {
+    Atom type;          /* actual type, None if property is not set */
+    int format;
+    int nitems;
+    void *data;         /* NULL if there is no data */
+} xaprop;
+xaprop *get_xaproperty_batch_at(const char *file, const char *func,
+    Window *wins, int nwins, Atom *props, Atom *types, int nprops);
+void xaprop_batch_free(xaprop *props, int n);
+char *xaprop_to_utf8(xaprop *prop);
+char *get_textproperty_at(const char *file, const char *func, Window win,
+    Atom prop);
+void *get_utf8_property_at(const char *file, const char *func, Window win,
+    Atom atom);
+char **get_utf8_property_list_at(const char *file, const char *func,
+    Window win, Atom atom, int *count);
 
 void fb_init(void);
 void fb_free(void);
+void fb_atoms_add(fb_atom *atoms);
+void fb_atoms_resolve(void);
 //Window Select_Window(Display *dpy);
 guint get_net_number_of_desktops();
 guint get_net_current_desktop ();
 guint get_net_wm_desktop(Window win);
 void get_net_wm_state(Window win, net_wm_state *nws);
 void get_net_wm_window_type(Window win, net_wm_window_type *nwwt);
+void parse_net_wm_state(Atom *state, int num, net_wm_state *nws);
+void parse_net_wm_window_type(Atom *state, int num, net_wm_window_type *nwwt);
 
 void calculate_position(panel *np);
 gchar *expand_tilda(gchar *file);
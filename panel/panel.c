@@ -15,6 +15,7 @@
 #include "misc.h"
 #include "bg.h"
 #include "gtkbgbox.h"
+#include "xev.h"
 
 
 static gchar version[] = PROJECT_VERSION;
@@ -116,59 +117,90 @@ print_wmdata(panel *p)
 }
 #endif
 
+static void
+panel_current_desktop(panel *p)
+{
+    p->curdesk = fb_ev_current_desktop(fbev);
+}
+
+static void
+panel_number_of_desktops(panel *p)
+{
+    p->desknum = fb_ev_number_of_desktops(fbev);
+}
+
+static void
+panel_root_bg_changed(panel *p)
+{
+    if (p->transparent)
+        fb_bg_notify_changed_bg(p->bg);
+}
+
+static void
+panel_desktop_geometry(panel *p)
+{
+    gtk_main_quit();
+}
+
+/* root window properties the panel follows. Each atom gets its own
+ * handler registration, so changes of other properties never reach
+ * panel_event_filter */
+static struct {
+    Atom *atom;
+    int signal;                 /* fbev signal to emit, or -1 */
+    void (*func)(panel *p);     /* called after signal */
+} root_props[] = {
+    { &a_NET_CLIENT_LIST, EV_CLIENT_LIST, NULL },
+    { &a_NET_CURRENT_DESKTOP, EV_CURRENT_DESKTOP, panel_current_desktop },
+    { &a_NET_NUMBER_OF_DESKTOPS, EV_NUMBER_OF_DESKTOPS,
+      panel_number_of_desktops },
+    { &a_NET_DESKTOP_NAMES, EV_DESKTOP_NAMES, NULL },
+    { &a_NET_ACTIVE_WINDOW, EV_ACTIVE_WINDOW, NULL },
+    { &a_NET_CLIENT_LIST_STACKING, EV_CLIENT_LIST_STACKING, NULL },
+    { &a_XROOTPMAP_ID, -1, panel_root_bg_changed },
+    { &a_NET_DESKTOP_GEOMETRY, -1, panel_desktop_geometry },
+};
+
+/* atom -> index in root_props + 1 */
+static fb_atom_table *root_atoms;
+
 static GdkFilterReturn
-panel_event_filter(GdkXEvent *xevent, GdkEvent *event, panel *p)
+panel_event_filter(XEvent *ev, panel *p)
 {
-    Atom at;
-    Window win;
-    XEvent *ev = (XEvent *) xevent;
+    guint i;
 
     ENTER;
-    DBG("win = 0x%lx\n", ev->xproperty.window);
-    if (ev->type != PropertyNotify )
+    DBG("win=%lx at=%ld\n", ev->xproperty.window, ev->xproperty.atom);
+    if (!(i = fb_atom_table_lookup(root_atoms, ev->xproperty.atom)))
         RET(GDK_FILTER_CONTINUE);
+    i--;
+    if (root_props[i].signal >= 0)
+        fb_ev_trigger(fbev, root_props[i].signal);
+    if (root_props[i].func)
+        root_props[i].func(p);
+    RET(GDK_FILTER_REMOVE);
+}
 
-    at = ev->xproperty.atom;
-    win = ev->xproperty.window;
-    DBG("win=%lx at=%ld\n", win, at);
-    if (win == GDK_ROOT_WINDOW()) {
-        if (at == a_NET_CLIENT_LIST) {
-            DBG("A_NET_CLIENT_LIST\n");
-            fb_ev_trigger(fbev, EV_CLIENT_LIST);
-        } else if (at == a_NET_CURRENT_DESKTOP) {
-            DBG("A_NET_CURRENT_DESKTOP\n");
-            p->curdesk = get_net_current_desktop();
-            fb_ev_trigger(fbev, EV_CURRENT_DESKTOP);
-        } else if (at == a_NET_NUMBER_OF_DESKTOPS) {
-            DBG("A_NET_NUMBER_OF_DESKTOPS\n");
-            p->desknum = get_net_number_of_desktops();
-            fb_ev_trigger(fbev, EV_NUMBER_OF_DESKTOPS);
-        } else if (at == a_NET_DESKTOP_NAMES) {
-            DBG("A_NET_DESKTOP_NAMES\n");
-            fb_ev_trigger(fbev, EV_DESKTOP_NAMES);
-        } else if (at == a_NET_ACTIVE_WINDOW) {
-            DBG("A_NET_ACTIVE_WINDOW\n");
-            fb_ev_trigger(fbev, EV_ACTIVE_WINDOW);
-        }else if (at == a_NET_CLIENT_LIST_STACKING) {
-            DBG("A_NET_CLIENT_LIST_STACKING\n");
-            fb_ev_trigger(fbev, EV_CLIENT_LIST_STACKING);
-        } else if (at == a_NET_WORKAREA) {
-            DBG("A_NET_WORKAREA\n");
-            //p->workarea = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_WORKAREA,
-            //      XA_CARDINAL, &p->wa_len);
-            //print_wmdata(p);
-        } else if (at == a_XROOTPMAP_ID) {
-            if (p->transparent)
-                fb_bg_notify_changed_bg(p->bg);
-        } else if (at == a_NET_DESKTOP_GEOMETRY) {
-            DBG("a_NET_DESKTOP_GEOMETRY\n");
-            gtk_main_quit();
-        } else
-            RET(GDK_FILTER_CONTINUE);
-        RET(GDK_FILTER_REMOVE);
+static void
+panel_set_root_filters(panel *p, gboolean add)
+{
+    guint i;
+
+    ENTER;
+    if (add && !root_atoms) {
+        root_atoms = fb_atom_table_new();
+        for (i = 0; i < G_N_ELEMENTS(root_props); i++)
+            fb_atom_table_add(root_atoms, *root_props[i].atom, i + 1);
+    }
+    for (i = 0; i < G_N_ELEMENTS(root_props); i++) {
+        if (add)
+            fb_xev_add(GDK_ROOT_WINDOW(), PropertyNotify, *root_props[i].atom,
+                (fb_xev_func) panel_event_filter, p);
+        else
+            fb_xev_remove(GDK_ROOT_WINDOW(), PropertyNotify,
+                *root_props[i].atom, (fb_xev_func) panel_event_filter, p);
     }
-    DBG("non root %lx\n", win);
-    RET(GDK_FILTER_CONTINUE);
+    RET();
 }
 
 /****************************************************
@@ -675,8 +707,7 @@ panel_start_gui(panel *p)
         panel_set_wm_strut(p);
 
     XSelectInput(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), GDK_ROOT_WINDOW(), PropertyChangeMask);
-    gdk_window_add_filter(gdk_get_default_root_window(),
-          (GdkFilterFunc)panel_event_filter, p);
+    panel_set_root_filters(p, TRUE);
     //XSync(GDK_DISPLAY(), False); //berte: not me
     gdk_flush();
     RET();
@@ -847,8 +878,7 @@ panel_stop(panel *p)
     p->plugins = NULL;
 
     XSelectInput(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), GDK_ROOT_WINDOW(), NoEventMask);
-    gdk_window_remove_filter(gdk_get_default_root_window(),
-          (GdkFilterFunc)panel_event_filter, p);
+    panel_set_root_filters(p, FALSE);
     gtk_widget_destroy(p->topgwin);
     gtk_widget_destroy(p->menu);
     g_object_unref(fbev);
@@ -993,6 +1023,7 @@ main(int argc, char *argv[])
     XSetLocaleModifiers("");
     XSetErrorHandler((XErrorHandler) handle_error);
     fb_init();
+    fb_xstat_init();
     do_argv(argc, argv);
     profile_file = g_build_filename(g_get_user_config_dir(),
         "fbpanel3", profile, NULL);
@@ -1018,6 +1049,7 @@ main(int argc, char *argv[])
         DBG("force_quit=%d\n", force_quit);
     } while (force_quit == 0);
     g_free(profile_file);
+    fb_xstat_dump();
     fb_free();
     exit(0);
 }
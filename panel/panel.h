@@ -3,6 +3,7 @@
 
 
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
 
@@ -111,6 +112,32 @@ typedef struct {
     unsigned int normal : 1;
 } net_wm_window_type;
 
+/* cached state of a managed window, shared by all plugins via fbev.
+ * Owned by FbEv - plugins must not free or modify it */
+struct _fb_client {
+    Window win;
+    guint desktop;
+    net_wm_state nws;
+    net_wm_window_type nwwt;
+    int x, y;
+    guint w, h;
+    gchar *name;
+    XClassHint ch;
+    gboolean urgency;    /* XUrgencyHint is set in WM_HINTS */
+    Pixmap icon_pixmap;  /* WM_HINTS icon and its mask, None if unset */
+    Pixmap icon_mask;
+    guint changed;       /* FB_CLIENT_* bits of current "window_changed" */
+    guint pending;       /* FB_CLIENT_* bits queued for refetch */
+    guint mark;          /* generation of last client list it was seen in */
+    int ev_x, ev_y;      /* geometry of latest ConfigureNotify, see ev.c */
+    guint ev_w, ev_h;
+    guint ev_geometry : 1;   /* ev_w, ev_h are pending */
+    guint ev_position : 1;   /* ev_x, ev_y are pending and in root coords */
+    guint ev_relative : 1;   /* some position was relative to WM frame */
+    guint resync : 1;        /* queued for position resync */
+    FbEv *ev;            /* registry it belongs to */
+};
+
 typedef struct {
     char *name;
     void (*cmd)(void);
@@ -120,6 +147,12 @@ extern command commands[];
 
 extern gchar *cprofile;
 
+/* entry of atom table, see fb_atoms_add */
+typedef struct {
+    Atom *atom;
+    const char *name;
+} fb_atom;
+
 extern Atom a_UTF8_STRING;
 extern Atom a_XROOTPMAP_ID;
 
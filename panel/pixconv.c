@@ -0,0 +1,364 @@
+/*
+ * Pixel format conversion for icon data.
+ *
+ * _NET_WM_ICON pixels come as ARGB values, one per long, so on 64-bit
+ * hosts half of every word is padding. gdk-pixbuf wants R, G, B, A bytes.
+ * Both directions boil down to narrowing (or widening) words and swapping
+ * red and blue bytes, which SIMD does several pixels at a time.
+ *
+ * Also cheap good quality downscaling of icons and thumbnails.
+ */
+
+#include <glib.h>
+
+#include "pixconv.h"
+
+//#define DEBUGPRN
+#include "dbg.h"
+
+/* vector kernels assume 8 byte longs, which x32 ABI does not have,
+ * and need target attribute */
+#if defined(__x86_64__) && defined(__GNUC__) && __SIZEOF_LONG__ == 8
+#define PIXCONV_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*argb_to_rgba_func)(const gulong *src, guchar *dst, int n);
+typedef void (*rgba_to_argb_func)(const guchar *src, gulong *dst, int n);
+
+static argb_to_rgba_func argb_to_rgba;
+static rgba_to_argb_func rgba_to_argb;
+
+static void
+argb_to_rgba_c(const gulong *src, guchar *dst, int n)
+{
+    guint32 argb;
+
+    while (n-- > 0) {
+        argb = *src++;
+        dst[0] = argb >> 16;
+        dst[1] = argb >> 8;
+        dst[2] = argb;
+        dst[3] = argb >> 24;
+        dst += 4;
+    }
+}
+
+static void
+rgba_to_argb_c(const guchar *src, gulong *dst, int n)
+{
+    while (n-- > 0) {
+        *dst++ = (guint32) src[3] << 24 | src[0] << 16 | src[1] << 8 | src[2];
+        src += 4;
+    }
+}
+
+static void
+rgb_to_argb_c(const guchar *src, gulong *dst, int n)
+{
+    while (n-- > 0) {
+        *dst++ = 0xff000000u | src[0] << 16 | src[1] << 8 | src[2];
+        src += 3;
+    }
+}
+
+#ifdef PIXCONV_X86
+
+/* swaps bytes 0 and 2 of every 32 bit word: ARGB <-> ABGR */
+__attribute__((target("sse2")))
+static inline __m128i
+swap_rb_sse2(__m128i x)
+{
+    return _mm_or_si128(
+        _mm_and_si128(x, _mm_set1_epi32(0xff00ff00)),
+        _mm_or_si128(
+            _mm_and_si128(_mm_slli_epi32(x, 16), _mm_set1_epi32(0xff0000)),
+            _mm_srli_epi32(_mm_slli_epi32(x, 8), 24)));
+}
+
+__attribute__((target("sse2")))
+static void
+argb_to_rgba_sse2(const gulong *src, guchar *dst, int n)
+{
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        /* move low halves of two longs into low 64 bits */
+        a = _mm_loadu_si128((const __m128i *) (src + i));
+        b = _mm_loadu_si128((const __m128i *) (src + i + 2));
+        a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *) (dst + 4 * i),
+            swap_rb_sse2(_mm_unpacklo_epi64(a, b)));
+    }
+    argb_to_rgba_c(src + i, dst + 4 * i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void
+rgba_to_argb_sse2(const guchar *src, gulong *dst, int n)
+{
+    __m128i x, zero = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = swap_rb_sse2(_mm_loadu_si128((const __m128i *) (src + 4 * i)));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi32(x, zero));
+        _mm_storeu_si128((__m128i *) (dst + i + 2),
+            _mm_unpackhi_epi32(x, zero));
+    }
+    rgba_to_argb_c(src + 4 * i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+swap_rb_avx2(__m256i x)
+{
+    const __m256i shuf = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    return _mm256_shuffle_epi8(x, shuf);
+}
+
+__attribute__((target("avx2")))
+static void
+argb_to_rgba_avx2(const gulong *src, guchar *dst, int n)
+{
+    const __m256i lows = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    __m256i a, b;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        /* gather low halves of four longs into low lane */
+        a = _mm256_loadu_si256((const __m256i *) (src + i));
+        b = _mm256_loadu_si256((const __m256i *) (src + i + 4));
+        a = _mm256_permutevar8x32_epi32(a, lows);
+        b = _mm256_permutevar8x32_epi32(b, lows);
+        _mm256_storeu_si256((__m256i *) (dst + 4 * i),
+            swap_rb_avx2(_mm256_permute2x128_si256(a, b, 0x20)));
+    }
+    argb_to_rgba_sse2(src + i, dst + 4 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+rgba_to_argb_avx2(const guchar *src, gulong *dst, int n)
+{
+    __m256i x;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        x = swap_rb_avx2(_mm256_loadu_si256((const __m256i *) (src + 4 * i)));
+        _mm256_storeu_si256((__m256i *) (dst + i),
+            _mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)));
+        _mm256_storeu_si256((__m256i *) (dst + i + 4),
+            _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    rgba_to_argb_sse2(src + 4 * i, dst + i, n - i);
+}
+
+#endif
+
+static void
+pixconv_init(void)
+{
+    static gsize done;
+
+    if (!g_once_init_enter(&done))
+        return;
+    argb_to_rgba = argb_to_rgba_c;
+    rgba_to_argb = rgba_to_argb_c;
+#ifdef PIXCONV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        DBG("using avx2 kernels\n");
+        argb_to_rgba = argb_to_rgba_avx2;
+        rgba_to_argb = rgba_to_argb_avx2;
+    } else {
+        /* always there on x86_64 */
+        DBG("using sse2 kernels\n");
+        argb_to_rgba = argb_to_rgba_sse2;
+        rgba_to_argb = rgba_to_argb_sse2;
+    }
+#endif
+    g_once_init_leave(&done, 1);
+}
+
+/* c * a / 255, rounded */
+static inline guchar
+mul_alpha(guint c, guint a)
+{
+    guint t = c * a + 128;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+static void
+premultiply(guchar *p, int stride, int w, int h)
+{
+    guchar *q;
+    int x, y;
+
+    for (y = 0; y < h; y++, p += stride) {
+        for (x = 0, q = p; x < w; x++, q += 4) {
+            if (q[3] == 255)
+                continue;
+            q[0] = mul_alpha(q[0], q[3]);
+            q[1] = mul_alpha(q[1], q[3]);
+            q[2] = mul_alpha(q[2], q[3]);
+        }
+    }
+}
+
+static void
+unpremultiply(guchar *p, int stride, int w, int h)
+{
+    guchar *q;
+    int x, y, i;
+
+    for (y = 0; y < h; y++, p += stride) {
+        for (x = 0, q = p; x < w; x++, q += 4) {
+            if (q[3] == 255 || q[3] == 0)
+                continue;
+            for (i = 0; i < 3; i++)
+                q[i] = MIN(255, (q[i] * 255 + q[3] / 2) / q[3]);
+        }
+    }
+}
+
+/* w pixels of dst row from rows r0 and r1, 2w pixels each */
+static void
+halve_row_c(const guchar *r0, const guchar *r1, guchar *dst, int w,
+    int n_channels)
+{
+    int x, i;
+
+    for (x = 0; x < w; x++) {
+        for (i = 0; i < n_channels; i++)
+            dst[i] = (r0[i] + r0[i + n_channels] + r1[i]
+                + r1[i + n_channels] + 2) >> 2;
+        r0 += 2 * n_channels;
+        r1 += 2 * n_channels;
+        dst += n_channels;
+    }
+}
+
+#ifdef PIXCONV_X86
+/* 4 channel version; 2 dst pixels per step */
+__attribute__((target("sse2")))
+static void
+halve_row_sse2(const guchar *r0, const guchar *r1, guchar *dst, int w)
+{
+    __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+    __m128i a, b, lo, hi;
+    int x;
+
+    for (x = 0; x + 2 <= w; x += 2) {
+        a = _mm_loadu_si128((const __m128i *) (r0 + 8 * x));
+        b = _mm_loadu_si128((const __m128i *) (r1 + 8 * x));
+        /* vertical sums, 16 bit per channel */
+        lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+            _mm_unpacklo_epi8(b, zero));
+        hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+            _mm_unpackhi_epi8(b, zero));
+        /* horizontal sums of pixel pairs */
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+        _mm_storel_epi64((__m128i *) (dst + 4 * x), _mm_packus_epi16(lo, lo));
+    }
+    halve_row_c(r0 + 8 * x, r1 + 8 * x, dst + 4 * x, w - x, 4);
+}
+#endif
+
+/* dst is half the size of src, odd row and column are dropped */
+static void
+pixbuf_halve(GdkPixbuf *src, GdkPixbuf *dst)
+{
+    const guchar *s;
+    guchar *d;
+    int sstride, dstride, w, h, y, n_channels;
+
+    s = gdk_pixbuf_get_pixels(src);
+    d = gdk_pixbuf_get_pixels(dst);
+    sstride = gdk_pixbuf_get_rowstride(src);
+    dstride = gdk_pixbuf_get_rowstride(dst);
+    w = gdk_pixbuf_get_width(dst);
+    h = gdk_pixbuf_get_height(dst);
+    n_channels = gdk_pixbuf_get_n_channels(dst);
+    for (y = 0; y < h; y++, s += 2 * sstride, d += dstride) {
+#ifdef PIXCONV_X86
+        if (n_channels == 4) {
+            halve_row_sse2(s, s + sstride, d, w);
+            continue;
+        }
+#endif
+        halve_row_c(s, s + sstride, d, w, n_channels);
+    }
+}
+
+GdkPixbuf *
+fb_pixbuf_scale(GdkPixbuf *src, int w, int h)
+{
+    GdkPixbuf *cur, *next, *ret;
+    int sw, sh;
+    gboolean alpha;
+
+    ENTER;
+    g_return_val_if_fail(src != NULL && w > 0 && h > 0, NULL);
+    sw = gdk_pixbuf_get_width(src);
+    sh = gdk_pixbuf_get_height(src);
+    if (sw == w && sh == h)
+        RET(g_object_ref(src));
+    if (sw / 2 < w || sh / 2 < h
+        || gdk_pixbuf_get_bits_per_sample(src) != 8
+        || gdk_pixbuf_get_colorspace(src) != GDK_COLORSPACE_RGB)
+        RET(gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_BILINEAR));
+
+    /* averaging straight colors would darken translucent edges */
+    alpha = gdk_pixbuf_get_has_alpha(src);
+    if (alpha) {
+        if (!(cur = gdk_pixbuf_copy(src)))
+            RET(NULL);
+        premultiply(gdk_pixbuf_get_pixels(cur),
+            gdk_pixbuf_get_rowstride(cur), sw, sh);
+    } else
+        cur = g_object_ref(src);
+    while (sw / 2 >= w && sh / 2 >= h) {
+        next = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8, sw / 2, sh / 2);
+        if (!next)
+            break;
+        pixbuf_halve(cur, next);
+        g_object_unref(cur);
+        cur = next;
+        sw /= 2;
+        sh /= 2;
+    }
+    if (alpha)
+        unpremultiply(gdk_pixbuf_get_pixels(cur),
+            gdk_pixbuf_get_rowstride(cur), sw, sh);
+    if (sw == w && sh == h)
+        RET(cur);
+    ret = gdk_pixbuf_scale_simple(cur, w, h, GDK_INTERP_BILINEAR);
+    g_object_unref(cur);
+    RET(ret);
+}
+
+void
+fb_argb_to_rgba(const gulong *src, guchar *dst, int n)
+{
+    pixconv_init();
+    argb_to_rgba(src, dst, n);
+}
+
+void
+fb_rgba_to_argb(const guchar *src, int n_channels, gulong *dst, int n)
+{
+    pixconv_init();
+    if (n_channels == 4)
+        rgba_to_argb(src, dst, n);
+    else
+        rgb_to_argb_c(src, dst, n);
+}
@@ -0,0 +1,25 @@
+#ifndef PIXCONV_H
+#define PIXCONV_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Pixel format conversion between _NET_WM_ICON data, which Xlib hands
+ * out as ARGB values in host longs, and gdk-pixbuf RGBA bytes.
+ * Vectorized where CPU allows it, best kernel is picked at runtime */
+
+/* n ARGB longs to n RGBA pixels, 4 bytes each */
+void fb_argb_to_rgba(const gulong *src, guchar *dst, int n);
+
+/* n RGB or RGBA pixels (n_channels is 3 or 4) to n ARGB longs;
+ * missing alpha is taken as opaque */
+void fb_rgba_to_argb(const guchar *src, int n_channels, gulong *dst, int n);
+
+/* Scales pixbuf to w x h. Downscale halves image with premultiplied 2x2
+ * box filter while it is at least twice the target, and leaves the last
+ * step, of less than 2x, to bilinear filter. Looks as good as
+ * GDK_INTERP_HYPER for icons and thumbnails at a fraction of its cost.
+ * Returns new reference, which may be to src itself if size matches */
+GdkPixbuf *fb_pixbuf_scale(GdkPixbuf *src, int w, int h);
+
+#endif
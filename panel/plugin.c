@@ -38,6 +38,10 @@ class_register(plugin_class *p)
     }
     p->dynamic = (the_panel != NULL); /* dynamic modules register after main */
     g_hash_table_insert(class_ht, p->type, p);
+    /* built-in plugins register before main, so their atoms go out with
+     * panel's own; dynamic ones are resolved in plugin_load */
+    if (p->atoms)
+        fb_atoms_add(p->atoms);
     RET();
 }
 
@@ -127,6 +131,7 @@ plugin_load(char *type)
     /* nothing was found */
     if (!(pc = class_get(type)))
         RET(NULL);
+    fb_atoms_resolve();
 
     DBG("%s priv_size=%d\n", pc->type, pc->priv_size);
     pp = g_malloc0(pc->priv_size);
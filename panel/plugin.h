@@ -30,6 +30,8 @@ typedef struct {
     void (*destructor)(struct _plugin_instance *this);
     void (*save_config)(struct _plugin_instance *this, FILE *fp);
     GtkWidget *(*edit_config)(struct _plugin_instance *this);
+    /* NULL-terminated table of atoms to intern before constructor runs */
+    fb_atom *atoms;
 } plugin_class;
 
 #define PLUGIN_CLASS(class) ((plugin_class *) class)
@@ -0,0 +1,297 @@
+/*
+ * X event demultiplexer.
+ *
+ * Instead of every module installing its own gdk filter, and every X
+ * event walking all of them, one global filter looks up handlers by
+ * (window, event type, atom) and calls only those registered for it.
+ */
+
+#include <glib.h>
+#include <gdk/gdk.h>
+#include <gdk/gdkx.h>
+#include <X11/Xlib.h>
+
+#include "xev.h"
+#include "xstat.h"
+
+//#define DEBUGPRN
+#include "dbg.h"
+
+typedef struct {
+    fb_xev_func func;           /* NULL if removed while dispatching */
+    gpointer data;
+} xev_handler;
+
+typedef struct {
+    /* key */
+    Window win;
+    int type;
+    Atom atom;
+    /* value */
+    GSList *handlers;
+} xev_entry;
+
+struct _fb_atom_table {
+    guint size;                 /* power of 2 */
+    guint num;
+    Atom *atoms;                /* None marks free slot */
+    guint *vals;
+};
+
+static GHashTable *entries;
+static int dispatching;
+static gboolean dirty;
+
+static guint
+xev_entry_hash(gconstpointer key)
+{
+    const xev_entry *e = key;
+
+    return (guint) e->win ^ ((guint) e->atom << 7) ^ ((guint) e->type << 25);
+}
+
+static gboolean
+xev_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const xev_entry *e1 = a, *e2 = b;
+
+    return e1->win == e2->win && e1->type == e2->type
+        && e1->atom == e2->atom;
+}
+
+static void
+xev_entry_free(xev_entry *e)
+{
+    g_slist_free_full(e->handlers, g_free);
+    g_free(e);
+}
+
+/* drops handlers that were removed during dispatching */
+static void
+xev_compact(void)
+{
+    GHashTableIter iter;
+    xev_entry *e;
+    GSList *l, *next;
+    xev_handler *h;
+
+    ENTER;
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &e, NULL)) {
+        for (l = e->handlers; l; l = next) {
+            next = l->next;
+            h = l->data;
+            if (!h->func) {
+                e->handlers = g_slist_delete_link(e->handlers, l);
+                g_free(h);
+            }
+        }
+        if (!e->handlers)
+            g_hash_table_iter_remove(&iter);
+    }
+    dirty = FALSE;
+    RET();
+}
+
+static GdkFilterReturn
+xev_dispatch(xev_entry *key, XEvent *xev)
+{
+    xev_entry *e;
+    xev_handler *h;
+    GSList *l;
+
+    if (!(e = g_hash_table_lookup(entries, key)))
+        return GDK_FILTER_CONTINUE;
+    for (l = e->handlers; l; l = l->next) {
+        h = l->data;
+        if (h->func && h->func(xev, h->data) == GDK_FILTER_REMOVE)
+            return GDK_FILTER_REMOVE;
+    }
+    return GDK_FILTER_CONTINUE;
+}
+
+static GdkFilterReturn
+xev_filter(GdkXEvent *xevent, GdkEvent *event, gpointer data)
+{
+    XEvent *xev = (XEvent *) xevent;
+    GdkFilterReturn ret;
+    xev_entry key;
+    const char *prev_event;
+    fb_trace_stamp prev_stamp, stamp;
+
+    key.win = xev->xany.window;
+    key.type = xev->type;
+    if (xev->type == PropertyNotify)
+        key.atom = xev->xproperty.atom;
+    else if (xev->type == ClientMessage)
+        key.atom = xev->xclient.message_type;
+    else
+        key.atom = None;
+    DBG("win=%lx type=%d atom=%ld\n", key.win, key.type, key.atom);
+
+    dispatching++;
+    prev_event = fb_xstat_set_event(fb_xstat_event_name(xev->type));
+    if (fb_trace_enabled) {
+        fb_trace_get(&prev_stamp);
+        stamp.event = fb_xstat_event_name(xev->type);
+        stamp.time = g_get_monotonic_time();
+        fb_trace_set(&stamp);
+    }
+    ret = xev_dispatch(&key, xev);
+    if (ret == GDK_FILTER_CONTINUE && key.atom != None) {
+        key.atom = None;
+        ret = xev_dispatch(&key, xev);
+    }
+    fb_xstat_set_event(prev_event);
+    if (fb_trace_enabled)
+        fb_trace_set(&prev_stamp);
+    if (!--dispatching && dirty)
+        xev_compact();
+    return ret;
+}
+
+void
+fb_xev_add(Window win, int type, Atom atom, fb_xev_func func, gpointer data)
+{
+    xev_entry key, *e;
+    xev_handler *h;
+
+    ENTER;
+    g_return_if_fail(func != NULL);
+    if (!entries) {
+        entries = g_hash_table_new_full(xev_entry_hash, xev_entry_equal,
+            (GDestroyNotify) xev_entry_free, NULL);
+        gdk_window_add_filter(NULL, xev_filter, NULL);
+    }
+    key.win = win;
+    key.type = type;
+    key.atom = atom;
+    if (!(e = g_hash_table_lookup(entries, &key))) {
+        e = g_new0(xev_entry, 1);
+        *e = key;
+        g_hash_table_add(entries, e);
+    }
+    h = g_new(xev_handler, 1);
+    h->func = func;
+    h->data = data;
+    e->handlers = g_slist_append(e->handlers, h);
+    RET();
+}
+
+void
+fb_xev_remove(Window win, int type, Atom atom, fb_xev_func func,
+    gpointer data)
+{
+    xev_entry key, *e;
+    xev_handler *h;
+    GSList *l;
+
+    ENTER;
+    if (!entries)
+        RET();
+    key.win = win;
+    key.type = type;
+    key.atom = atom;
+    if (!(e = g_hash_table_lookup(entries, &key)))
+        RET();
+    for (l = e->handlers; l; l = l->next) {
+        h = l->data;
+        if (h->func == func && h->data == data)
+            break;
+    }
+    if (!l)
+        RET();
+    if (dispatching) {
+        /* entry may be walked right now, unlink it later */
+        h->func = NULL;
+        dirty = TRUE;
+        RET();
+    }
+    e->handlers = g_slist_delete_link(e->handlers, l);
+    g_free(h);
+    if (!e->handlers)
+        g_hash_table_remove(entries, e);
+    RET();
+}
+
+/* open addressing with linear probing; kept at most half full */
+static guint
+atom_table_slot(fb_atom_table *t, Atom atom)
+{
+    guint i;
+
+    i = ((guint) atom * 2654435761u) & (t->size - 1);
+    while (t->atoms[i] != None && t->atoms[i] != atom)
+        i = (i + 1) & (t->size - 1);
+    return i;
+}
+
+static void
+atom_table_resize(fb_atom_table *t, guint size)
+{
+    Atom *atoms = t->atoms;
+    guint *vals = t->vals;
+    guint i, j, old = t->size;
+
+    t->size = size;
+    t->atoms = g_new0(Atom, size);
+    t->vals = g_new0(guint, size);
+    for (i = 0; i < old; i++) {
+        if (atoms[i] == None)
+            continue;
+        j = atom_table_slot(t, atoms[i]);
+        t->atoms[j] = atoms[i];
+        t->vals[j] = vals[i];
+    }
+    g_free(atoms);
+    g_free(vals);
+}
+
+fb_atom_table *
+fb_atom_table_new(void)
+{
+    fb_atom_table *t;
+
+    ENTER;
+    t = g_new0(fb_atom_table, 1);
+    atom_table_resize(t, 16);
+    RET(t);
+}
+
+void
+fb_atom_table_free(fb_atom_table *t)
+{
+    ENTER;
+    if (!t)
+        RET();
+    g_free(t->atoms);
+    g_free(t->vals);
+    g_free(t);
+    RET();
+}
+
+void
+fb_atom_table_add(fb_atom_table *t, Atom atom, guint val)
+{
+    guint i;
+
+    ENTER;
+    g_return_if_fail(atom != None && val != 0);
+    if (2 * (t->num + 1) > t->size)
+        atom_table_resize(t, 2 * t->size);
+    i = atom_table_slot(t, atom);
+    if (t->atoms[i] == None) {
+        t->atoms[i] = atom;
+        t->num++;
+    }
+    t->vals[i] = val;
+    RET();
+}
+
+guint
+fb_atom_table_lookup(fb_atom_table *t, Atom atom)
+{
+    if (atom == None)
+        return 0;
+    return t->vals[atom_table_slot(t, atom)];
+}
@@ -0,0 +1,28 @@
+#ifndef XEV_H
+#define XEV_H
+
+#include <X11/Xlib.h>
+#include <gdk/gdk.h>
+
+/* X event handler. Returning GDK_FILTER_REMOVE stops dispatching and
+ * drops the event, as a gdk filter would */
+typedef GdkFilterReturn (*fb_xev_func)(XEvent *xev, gpointer data);
+
+/* Registers handler for events of given type reported to window win.
+ * atom selects property of PropertyNotify or message_type of
+ * ClientMessage; None matches any. Other event types must pass None */
+void fb_xev_add(Window win, int type, Atom atom, fb_xev_func func,
+    gpointer data);
+void fb_xev_remove(Window win, int type, Atom atom, fb_xev_func func,
+    gpointer data);
+
+/* Maps atoms to small non-zero values - handler indexes, flag bits.
+ * Build it once atoms are resolved; lookup of an atom that was not
+ * added returns 0, usually after probing a single slot */
+typedef struct _fb_atom_table fb_atom_table;
+fb_atom_table *fb_atom_table_new(void);
+void fb_atom_table_free(fb_atom_table *t);
+void fb_atom_table_add(fb_atom_table *t, Atom atom, guint val);
+guint fb_atom_table_lookup(fb_atom_table *t, Atom atom);
+
+#endif
@@ -0,0 +1,462 @@
+/*
+ * X traffic accounting: calls, requests, reply bytes and wall time of
+ * synchronous X requests, grouped by event, caller and operation.
+ * Also event-to-draw latency histograms, grouped by event and plugin.
+ */
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+#include "xstat.h"
+
+//#define DEBUGPRN
+#include "dbg.h"
+
+gboolean fb_xstat_enabled;
+
+typedef struct {
+    /* key */
+    const char *event;
+    const char *file;
+    const char *func;
+    const char *op;
+    /* value */
+    gulong calls;
+    gulong requests;
+    gulong bytes;
+    gint64 usec;
+} xstat_rec;
+
+static GHashTable *recs;
+static const char *cur_event = "-";
+static gchar *dump_path;
+
+typedef struct {
+    const char *name;
+    const gulong *value;
+} xstat_counter;
+
+static GSList *counters;
+
+gboolean fb_trace_enabled;
+
+/* latency buckets are powers of 2 microseconds, from 128us to 4s */
+#define TRACE_MIN_SHIFT  7
+#define TRACE_BUCKETS    16
+
+typedef struct {
+    /* key */
+    const char *event;
+    const char *plugin;
+    /* value */
+    gulong count;
+    gulong buckets[TRACE_BUCKETS];
+    gint64 sum, max;
+} trace_rec;
+
+/* what widget waits to be drawn for, kept as its qdata */
+typedef struct {
+    fb_trace_stamp stamp;
+    const char *plugin;
+} trace_pending;
+
+static GHashTable *traces;
+static fb_trace_stamp cur_stamp;
+static GQuark trace_quark;
+
+static void trace_dump(FILE *fp);
+
+static const char *event_names[LASTEvent] = {
+    [KeyPress] = "KeyPress",
+    [KeyRelease] = "KeyRelease",
+    [ButtonPress] = "ButtonPress",
+    [ButtonRelease] = "ButtonRelease",
+    [MotionNotify] = "MotionNotify",
+    [EnterNotify] = "EnterNotify",
+    [LeaveNotify] = "LeaveNotify",
+    [FocusIn] = "FocusIn",
+    [FocusOut] = "FocusOut",
+    [KeymapNotify] = "KeymapNotify",
+    [Expose] = "Expose",
+    [GraphicsExpose] = "GraphicsExpose",
+    [NoExpose] = "NoExpose",
+    [VisibilityNotify] = "VisibilityNotify",
+    [CreateNotify] = "CreateNotify",
+    [DestroyNotify] = "DestroyNotify",
+    [UnmapNotify] = "UnmapNotify",
+    [MapNotify] = "MapNotify",
+    [MapRequest] = "MapRequest",
+    [ReparentNotify] = "ReparentNotify",
+    [ConfigureNotify] = "ConfigureNotify",
+    [ConfigureRequest] = "ConfigureRequest",
+    [GravityNotify] = "GravityNotify",
+    [ResizeRequest] = "ResizeRequest",
+    [CirculateNotify] = "CirculateNotify",
+    [CirculateRequest] = "CirculateRequest",
+    [PropertyNotify] = "PropertyNotify",
+    [SelectionClear] = "SelectionClear",
+    [SelectionRequest] = "SelectionRequest",
+    [SelectionNotify] = "SelectionNotify",
+    [ColormapNotify] = "ColormapNotify",
+    [ClientMessage] = "ClientMessage",
+    [MappingNotify] = "MappingNotify",
+};
+
+const char *
+fb_xstat_event_name(int type)
+{
+    if (type >= 0 && type < LASTEvent && event_names[type])
+        return event_names[type];
+    return "ExtensionEvent";
+}
+
+const char *
+fb_xstat_set_event(const char *event)
+{
+    const char *prev = cur_event;
+
+    cur_event = event ? event : "-";
+    return prev;
+}
+
+static guint
+xstat_rec_hash(gconstpointer key)
+{
+    const xstat_rec *r = key;
+
+    return g_str_hash(r->event) ^ (g_str_hash(r->file) << 3)
+        ^ (g_str_hash(r->func) << 7) ^ (g_str_hash(r->op) << 11);
+}
+
+static gboolean
+xstat_rec_equal(gconstpointer a, gconstpointer b)
+{
+    const xstat_rec *r1 = a, *r2 = b;
+
+    return !strcmp(r1->event, r2->event) && !strcmp(r1->file, r2->file)
+        && !strcmp(r1->func, r2->func) && !strcmp(r1->op, r2->op);
+}
+
+void
+fb_xstat_end(gint64 start, const char *op, const char *file,
+    const char *func, int requests, gulong bytes)
+{
+    xstat_rec key, *r;
+    const char *s;
+
+    if (!fb_xstat_enabled)
+        return;
+    /* strip directory part of __FILE__ */
+    if ((s = strrchr(file, '/')))
+        file = s + 1;
+    key.event = cur_event;
+    key.file = file;
+    key.func = func;
+    key.op = op;
+    if (!(r = g_hash_table_lookup(recs, &key))) {
+        r = g_new0(xstat_rec, 1);
+        *r = key;
+        g_hash_table_add(recs, r);
+    }
+    r->calls++;
+    r->requests += requests;
+    r->bytes += bytes;
+    if (start)
+        r->usec += g_get_monotonic_time() - start;
+}
+
+static gint
+xstat_rec_cmp(gconstpointer a, gconstpointer b)
+{
+    const xstat_rec *r1 = *(xstat_rec **) a, *r2 = *(xstat_rec **) b;
+
+    if (r1->usec != r2->usec)
+        return r1->usec < r2->usec ? 1 : -1;
+    return r1->bytes < r2->bytes ? 1 : (r1->bytes > r2->bytes ? -1 : 0);
+}
+
+void
+fb_xstat_add_counter(const char *name, const gulong *value)
+{
+    xstat_counter *c;
+
+    ENTER;
+    c = g_new(xstat_counter, 1);
+    c->name = name;
+    c->value = value;
+    counters = g_slist_append(counters, c);
+    RET();
+}
+
+void
+fb_xstat_remove_counter(const gulong *value)
+{
+    GSList *l;
+
+    ENTER;
+    for (l = counters; l; l = l->next) {
+        if (((xstat_counter *) l->data)->value == value) {
+            g_free(l->data);
+            counters = g_slist_delete_link(counters, l);
+            break;
+        }
+    }
+    RET();
+}
+
+void
+fb_xstat_dump(void)
+{
+    GHashTableIter iter;
+    GPtrArray *arr;
+    xstat_rec *r, total = { 0 };
+    xstat_counter *c;
+    GSList *l;
+    FILE *fp = stderr;
+    guint i;
+
+    ENTER;
+    if (!(fb_xstat_enabled || fb_trace_enabled))
+        RET();
+    if (dump_path && !(fp = fopen(dump_path, "a"))) {
+        ERR("xstats: can't open %s\n", dump_path);
+        fp = stderr;
+    }
+    if (fb_trace_enabled)
+        trace_dump(fp);
+    if (!fb_xstat_enabled)
+        goto out;
+    arr = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, recs);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &r, NULL))
+        g_ptr_array_add(arr, r);
+    g_ptr_array_sort(arr, xstat_rec_cmp);
+
+    fprintf(fp, "fbpanel X traffic, pid %d\n", (int) getpid());
+    fprintf(fp, "%-18s %-16s %-28s %-22s %8s %8s %10s %10s\n",
+        "event", "file", "caller", "op", "calls", "requests", "bytes",
+        "ms");
+    for (i = 0; i < arr->len; i++) {
+        r = g_ptr_array_index(arr, i);
+        fprintf(fp, "%-18s %-16s %-28s %-22s %8lu %8lu %10lu %10.2f\n",
+            r->event, r->file, r->func, r->op, r->calls, r->requests,
+            r->bytes, r->usec / 1000.0);
+        total.calls += r->calls;
+        total.requests += r->requests;
+        total.bytes += r->bytes;
+        total.usec += r->usec;
+    }
+    fprintf(fp, "%-18s %-16s %-28s %-22s %8lu %8lu %10lu %10.2f\n",
+        "total", "", "", "", total.calls, total.requests, total.bytes,
+        total.usec / 1000.0);
+    g_ptr_array_free(arr, TRUE);
+    for (l = counters; l; l = l->next) {
+        c = l->data;
+        fprintf(fp, "%-30s %10lu\n", c->name, *c->value);
+    }
+out:
+    if (fp != stderr)
+        fclose(fp);
+    else
+        fflush(fp);
+    RET();
+}
+
+void
+fb_trace_get(fb_trace_stamp *s)
+{
+    *s = cur_stamp;
+}
+
+void
+fb_trace_set(const fb_trace_stamp *s)
+{
+    cur_stamp = *s;
+}
+
+static guint
+trace_rec_hash(gconstpointer key)
+{
+    const trace_rec *r = key;
+
+    return g_str_hash(r->event) ^ (g_str_hash(r->plugin) << 5);
+}
+
+static gboolean
+trace_rec_equal(gconstpointer a, gconstpointer b)
+{
+    const trace_rec *r1 = a, *r2 = b;
+
+    return !strcmp(r1->event, r2->event) && !strcmp(r1->plugin, r2->plugin);
+}
+
+static void
+trace_record(const char *event, const char *plugin, gint64 usec)
+{
+    trace_rec key, *r;
+    int b;
+
+    key.event = event;
+    key.plugin = plugin;
+    if (!(r = g_hash_table_lookup(traces, &key))) {
+        r = g_new0(trace_rec, 1);
+        r->event = event;
+        r->plugin = plugin;
+        g_hash_table_add(traces, r);
+    }
+    for (b = 0; b < TRACE_BUCKETS - 1 && usec >= (1 << (b + TRACE_MIN_SHIFT));
+         b++)
+        ;
+    r->buckets[b]++;
+    r->count++;
+    r->sum += usec;
+    if (usec > r->max)
+        r->max = usec;
+}
+
+static gboolean
+trace_draw(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+    trace_pending *p;
+
+    p = g_object_get_qdata(G_OBJECT(widget), trace_quark);
+    if (p && p->stamp.event) {
+        trace_record(p->stamp.event, p->plugin,
+            g_get_monotonic_time() - p->stamp.time);
+        p->stamp.event = NULL;
+    }
+    return FALSE;
+}
+
+/* Notes that widget was changed because of event being handled now. If it
+ * already waits for a draw, the older stamp is kept, unless it is so old
+ * that the widget was probably never redrawn for it */
+void
+fb_trace_mark(GtkWidget *widget, const char *plugin)
+{
+    trace_pending *p;
+
+    if (!fb_trace_enabled || !cur_stamp.event || !widget)
+        return;
+    if (!(p = g_object_get_qdata(G_OBJECT(widget), trace_quark))) {
+        p = g_new0(trace_pending, 1);
+        g_object_set_qdata_full(G_OBJECT(widget), trace_quark, p, g_free);
+        g_signal_connect_after(G_OBJECT(widget), "draw",
+            G_CALLBACK(trace_draw), NULL);
+    }
+    if (p->stamp.event && cur_stamp.time - p->stamp.time < G_USEC_PER_SEC)
+        return;
+    p->stamp = cur_stamp;
+    p->plugin = plugin;
+}
+
+static gint
+trace_rec_cmp(gconstpointer a, gconstpointer b)
+{
+    const trace_rec *r1 = *(trace_rec **) a, *r2 = *(trace_rec **) b;
+    int ret;
+
+    if ((ret = strcmp(r1->plugin, r2->plugin)))
+        return ret;
+    return strcmp(r1->event, r2->event);
+}
+
+/* upper bound of bucket where given fraction of samples is reached */
+static gint64
+trace_percentile(trace_rec *r, double frac)
+{
+    gulong n = 0;
+    int b;
+
+    for (b = 0; b < TRACE_BUCKETS - 1; b++) {
+        n += r->buckets[b];
+        if (n >= frac * r->count)
+            break;
+    }
+    return b < TRACE_BUCKETS - 1 ? (1 << (b + TRACE_MIN_SHIFT)) : r->max;
+}
+
+static void
+trace_dump(FILE *fp)
+{
+    GHashTableIter iter;
+    GPtrArray *arr;
+    trace_rec *r;
+    guint i;
+    int b;
+
+    arr = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, traces);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &r, NULL))
+        g_ptr_array_add(arr, r);
+    g_ptr_array_sort(arr, trace_rec_cmp);
+
+    fprintf(fp, "fbpanel event-to-draw latency, pid %d, "
+        "percentiles are bucket upper bounds\n", (int) getpid());
+    fprintf(fp, "%-12s %-18s %8s %9s %9s %9s %9s %9s\n",
+        "plugin", "event", "count", "avg ms", "p50 ms", "p90 ms", "p99 ms",
+        "max ms");
+    for (i = 0; i < arr->len; i++) {
+        r = g_ptr_array_index(arr, i);
+        fprintf(fp, "%-12s %-18s %8lu %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+            r->plugin, r->event, r->count,
+            r->sum / 1000.0 / r->count,
+            trace_percentile(r, 0.5) / 1000.0,
+            trace_percentile(r, 0.9) / 1000.0,
+            trace_percentile(r, 0.99) / 1000.0,
+            r->max / 1000.0);
+        fprintf(fp, "    histogram:");
+        for (b = 0; b < TRACE_BUCKETS; b++)
+            fprintf(fp, " %lu", r->buckets[b]);
+        fprintf(fp, "\n");
+    }
+    g_ptr_array_free(arr, TRUE);
+}
+
+static gboolean
+xstat_sighup(gpointer data)
+{
+    fb_xstat_dump();
+    return TRUE;
+}
+
+/* TRUE if variable is set and not "0"; path other than "1" becomes
+ * dump destination */
+static gboolean
+xstat_getenv(const char *name)
+{
+    const char *env;
+
+    env = g_getenv(name);
+    if (!env || !*env || !strcmp(env, "0"))
+        return FALSE;
+    if (strcmp(env, "1") && !dump_path)
+        dump_path = g_strdup(env);
+    return TRUE;
+}
+
+void
+fb_xstat_init(void)
+{
+    ENTER;
+    if (xstat_getenv("FBPANEL_XSTATS")) {
+        fb_xstat_enabled = TRUE;
+        recs = g_hash_table_new_full(xstat_rec_hash, xstat_rec_equal,
+            g_free, NULL);
+    }
+    if (xstat_getenv("FBPANEL_LATENCY")) {
+        fb_trace_enabled = TRUE;
+        traces = g_hash_table_new_full(trace_rec_hash, trace_rec_equal,
+            g_free, NULL);
+        trace_quark = g_quark_from_static_string("fb-trace-pending");
+    }
+    if (fb_xstat_enabled || fb_trace_enabled)
+        g_unix_signal_add(SIGHUP, xstat_sighup, NULL);
+    RET();
+}
@@ -0,0 +1,66 @@
+#ifndef XSTAT_H
+#define XSTAT_H
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+
+/* X traffic accounting. Enabled by FBPANEL_XSTATS environment variable:
+ * counters are dumped at exit and on SIGHUP, to stderr or, if variable
+ * holds a path, appended to that file.
+ *
+ * Every record is tagged by source file and function of the caller and
+ * by the X event being dispatched when it happened */
+
+/* where accounted call is made from; expands to two arguments */
+#define FB_XSTAT_HERE __FILE__, G_STRFUNC
+
+extern gboolean fb_xstat_enabled;
+
+void fb_xstat_init(void);
+void fb_xstat_dump(void);
+
+/* Returns start time, or 0 if accounting is off. Pass it to fb_xstat_end
+ * along with number of requests and reply bytes */
+static inline gint64
+fb_xstat_begin(void)
+{
+    return fb_xstat_enabled ? g_get_monotonic_time() : 0;
+}
+
+void fb_xstat_end(gint64 start, const char *op, const char *file,
+    const char *func, int requests, gulong bytes);
+
+/* names event whose handlers run now; returns previous one for restoring */
+const char *fb_xstat_set_event(const char *event);
+const char *fb_xstat_event_name(int type);
+
+/* Named counter kept by some module, printed along with X traffic.
+ * Name must be a static string; remove counter before value goes away */
+void fb_xstat_add_counter(const char *name, const gulong *value);
+void fb_xstat_remove_counter(const gulong *value);
+
+/* wire size of property reply carrying nitems of given format */
+#define FB_XSTAT_PROP_BYTES(nitems, format) \
+    (32 + (((gulong) (nitems) * ((format) / 8) + 3) & ~3UL))
+
+/* Event-to-pixel latency tracing, enabled by FBPANEL_LATENCY environment
+ * variable and dumped along with X traffic counters.
+ *
+ * The demultiplexer stamps every X event it dispatches. A plugin that
+ * changes a widget in response calls fb_trace_mark; when the widget is
+ * drawn next time, the time since the event is added to histogram of
+ * that event type and plugin. Work deferred to idle carries the stamp
+ * over with fb_trace_get/fb_trace_set */
+typedef struct {
+    const char *event;          /* NULL if nothing is being traced */
+    gint64 time;
+} fb_trace_stamp;
+
+extern gboolean fb_trace_enabled;
+
+void fb_trace_get(fb_trace_stamp *s);
+void fb_trace_set(const fb_trace_stamp *s);
+void fb_trace_mark(GtkWidget *widget, const char *plugin);
+
+#endif
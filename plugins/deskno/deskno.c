@@ -56,9 +56,10 @@ name_update(GtkWidget *widget, deskno_priv *dc)
     char buffer [15];
 
     ENTER;
-    dc->deskno = get_net_current_desktop();
+    dc->deskno = fb_ev_current_desktop(fbev);
     sprintf(buffer, "<b>%d</b>", dc->deskno + 1);
     gtk_label_set_markup(GTK_LABEL(dc->namew), buffer);
+    fb_trace_mark(dc->namew, "deskno");
     RET(TRUE);
 }
 
@@ -66,7 +67,7 @@ static gint
 update(GtkWidget *widget, deskno_priv *dc)
 {
     ENTER;
-    dc->desknum = get_net_number_of_desktops();
+    dc->desknum = fb_ev_number_of_desktops(fbev);
     RET(TRUE);
 }
 
@@ -16,7 +16,7 @@ typedef struct {
     GtkWidget  *main;
     int         dno;            // current desktop nomer
     int         dnum;           // number of desktops
-    char      **dnames;         // desktop names
+    char      **dnames;         // desktop names, owned by fbev
     int         dnames_num;     // number of desktop names
     char      **lnames;         // label names
     char       *fmt;    
@@ -34,6 +34,7 @@ update_dno(GtkWidget *widget, deskno_priv *dc)
     ENTER;
     dc->dno = fb_ev_current_desktop(fbev);
     gtk_button_set_label(GTK_BUTTON(dc->main), dc->lnames[dc->dno]);
+    fb_trace_mark(dc->main, "deskno2");
     
     RET();
 }
@@ -45,11 +46,9 @@ update_all(GtkWidget *widget, deskno_priv *dc)
     
     ENTER;
     dc->dnum = fb_ev_number_of_desktops(fbev);
-    if (dc->dnames)
-        g_strfreev (dc->dnames);
     if (dc->lnames)
         g_strfreev (dc->lnames);
-    dc->dnames = get_utf8_property_list(GDK_ROOT_WINDOW(), a_NET_DESKTOP_NAMES, &(dc->dnames_num));
+    dc->dnames = fb_ev_desktop_names(fbev, &(dc->dnames_num));
     dc->lnames = g_new0 (gchar*, dc->dnum + 1);
     for (i = 0; i < MIN(dc->dnum, dc->dnames_num); i++) {
         dc->lnames[i] = g_strdup(dc->dnames[i]);
@@ -113,8 +112,6 @@ deskno_destructor(plugin_instance *p)
     /* disconnect ALL handlers matching func and data */
     g_signal_handlers_disconnect_by_func(G_OBJECT(fbev), update_dno, dc);
     g_signal_handlers_disconnect_by_func(G_OBJECT(fbev), update_all, dc);
-    if (dc->dnames)
-        g_strfreev(dc->dnames);
     if (dc->lnames)
         g_strfreev(dc->lnames);
     RET();
@@ -16,6 +16,7 @@
 #include "panel.h"
 #include "misc.h"
 #include "plugin.h"
+#include "pixconv.h"
 
 
 //#define DEBUGPRN
@@ -28,53 +29,17 @@ typedef struct wmpix_t {
     XClassHint ch;
 } wmpix_t;
 
-struct _icons;
-typedef struct _task{
-    struct _icons *ics;
-    Window win;
-    int refcount;
-    XClassHint ch;    
-} task;
-
 typedef struct _icons{
     plugin_instance plugin;
-    Window *wins;
-    int win_num;
-    GHashTable  *task_list;
-    int num_tasks;
     wmpix_t *wmpix; 
     wmpix_t *dicon;
 } icons_priv;
 
-static void ics_propertynotify(icons_priv *ics, XEvent *ev);
-static GdkFilterReturn ics_event_filter( XEvent *, GdkEvent *, icons_priv *);
 static void icons_destructor(plugin_instance *p);
 
 /******************************************/
 /* Resource Release Code                  */
 /******************************************/
-static void
-free_task(icons_priv *ics, task *tk, int hdel)
-{
-    ENTER;
-    ics->num_tasks--; 
-    if (hdel)
-        g_hash_table_remove(ics->task_list, &tk->win);
-    if (tk->ch.res_class)
-        XFree(tk->ch.res_class);
-    if (tk->ch.res_name)
-        XFree(tk->ch.res_name);
-    g_free(tk);
-    RET();
-}
-
-static gboolean
-task_remove_every(Window *win, task *tk)
-{
-    free_task(tk->ics, tk, 0);
-    return TRUE;
-}
-
 
 static void
 drop_config(icons_priv *ics)
@@ -100,60 +65,20 @@ drop_config(icons_priv *ics)
         g_free(ics->dicon);
         ics->dicon = NULL;
     }
-
-    /* free task list */
-    g_hash_table_foreach_remove(ics->task_list,
-        (GHRFunc) task_remove_every, (gpointer)ics);
-
-    if (ics->wins)
-    {
-        DBG("free ics->wins\n");
-        XFree(ics->wins);
-        ics->wins = NULL;
-    }
-    RET();
-}
-
-static void
-get_wmclass(task *tk)
-{
-    ENTER;
-    if (tk->ch.res_name)
-        XFree(tk->ch.res_name);
-    if (tk->ch.res_class)
-        XFree(tk->ch.res_class);
-    if (!XGetClassHint (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win, &tk->ch)) 
-        tk->ch.res_class = tk->ch.res_name = NULL;
-    DBG("name=%s class=%s\n", tk->ch.res_name, tk->ch.res_class);
     RET();
 }
 
 
-
-
-static inline task *
-find_task (icons_priv * ics, Window win)
-{
-    ENTER;
-    RET(g_hash_table_lookup(ics->task_list, &win));
-}
-
-
-static int task_has_icon(task *tk)
+static int task_has_icon(fb_client *c)
 {
     XWMHints *hints;
-    gulong *data;
-    int n;
 
     ENTER;
-    data = get_xaproperty(tk->win, a_NET_WM_ICON, XA_CARDINAL, &n);
-    if (data)
-    {
-        XFree(data);
+    /* probe only, do not download icon pixels */
+    if (get_xaproperty_info(c->win, a_NET_WM_ICON, XA_CARDINAL, NULL, NULL))
         RET(1);
-    }
     
-    hints = XGetWMHints(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win);
+    hints = get_wm_hints(c->win);
     if (hints)
     {
         if ((hints->flags & IconPixmapHint) || (hints->flags & IconMaskHint))
@@ -167,23 +92,23 @@ static int task_has_icon(task *tk)
 }
 
 static wmpix_t *
-get_user_icon(icons_priv *ics, task *tk)
+get_user_icon(icons_priv *ics, fb_client *c)
 {
     wmpix_t *tmp;
     int mc, mn;
 
     ENTER;
-    if (!(tk->ch.res_class || tk->ch.res_name))
+    if (!(c->ch.res_class || c->ch.res_name))
         RET(NULL);
-    DBG("\nch.res_class=[%s] ch.res_name=[%s]\n", tk->ch.res_class,
-        tk->ch.res_name);
+    DBG("\nch.res_class=[%s] ch.res_name=[%s]\n", c->ch.res_class,
+        c->ch.res_name);
 
     for (tmp = ics->wmpix; tmp; tmp = tmp->next)
     { 
         DBG("tmp.res_class=[%s] tmp.res_name=[%s]\n", tmp->ch.res_class,
             tmp->ch.res_name);
-        mc = !tmp->ch.res_class || !strcmp(tmp->ch.res_class, tk->ch.res_class);
-        mn = !tmp->ch.res_name  || !strcmp(tmp->ch.res_name, tk->ch.res_name);
+        mc = !tmp->ch.res_class || !strcmp(tmp->ch.res_class, c->ch.res_class);
+        mn = !tmp->ch.res_name  || !strcmp(tmp->ch.res_name, c->ch.res_name);
         DBG("mc=%d mn=%d\n", mc, mn);
         if (mc && mn)
         {
@@ -203,7 +128,7 @@ pixbuf2argb (GdkPixbuf *pixbuf, int *size)
     guchar *pixels;
     gulong *p;
     gint width, height, stride;
-    gint x, y;
+    gint y;
     gint n_channels;
 
     ENTER;
@@ -212,50 +137,34 @@ pixbuf2argb (GdkPixbuf *pixbuf, int *size)
     height = gdk_pixbuf_get_height (pixbuf);
     stride = gdk_pixbuf_get_rowstride (pixbuf);
     n_channels = gdk_pixbuf_get_n_channels (pixbuf);
-      
+
     *size += 2 + width * height;
     p = data = g_malloc (*size * sizeof (gulong));
     *p++ = width;
     *p++ = height;
-    
+
     pixels = gdk_pixbuf_get_pixels (pixbuf);
-    
-    for (y = 0; y < height; y++)
-    {
-        for (x = 0; x < width; x++)
-        {
-            guchar r, g, b, a;
-            
-            r = pixels[y*stride + x*n_channels + 0];
-            g = pixels[y*stride + x*n_channels + 1];
-            b = pixels[y*stride + x*n_channels + 2];
-            if (n_channels >= 4)
-                a = pixels[y*stride + x*n_channels + 3];
-            else
-                a = 255;
-            
-            *p++ = a << 24 | r << 16 | g << 8 | b ;
-        }
-    }
+    for (y = 0; y < height; y++, pixels += stride, p += width)
+        fb_rgba_to_argb(pixels, n_channels, p, width);
     RET(data);
 }
 
 
 
 static void
-set_icon_maybe (icons_priv *ics, task *tk)
+set_icon_maybe (fb_client *c, icons_priv *ics)
 {
     wmpix_t *pix;
 
     ENTER;
-    g_assert ((ics != NULL) && (tk != NULL));
-    g_return_if_fail(tk != NULL);
+    g_assert ((ics != NULL) && (c != NULL));
+    g_return_if_fail(c != NULL);
 
 
-    pix = get_user_icon(ics, tk);
+    pix = get_user_icon(ics, c);
     if (!pix)
     {
-        if (task_has_icon(tk))
+        if (task_has_icon(c))
             RET();
         pix = ics->dicon;
     } 
@@ -263,7 +172,7 @@ set_icon_maybe (icons_priv *ics, task *tk)
         RET();
 
     DBG("%s size=%d\n", pix->ch.res_name, pix->size);
-    XChangeProperty (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win,
+    XChangeProperty (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), c->win,
           a_NET_WM_ICON, XA_CARDINAL, 32, PropModeReplace, (guchar*) pix->data, pix->size);
 
     RET();
@@ -271,111 +180,25 @@ set_icon_maybe (icons_priv *ics, task *tk)
 
 
 
-/* tell to remove element with zero refcount */
-static gboolean
-task_remove_stale(Window *win, task *tk)
-{
-    ENTER;
-    if (tk->refcount-- == 0)
-    {
-        free_task(tk->ics, tk, 0);
-        RET(TRUE);
-    }
-    RET(FALSE);
-}
-
 /*****************************************************
  * handlers for NET actions                          *
  *****************************************************/
 
-static GdkFilterReturn
-ics_event_filter( XEvent *xev, GdkEvent *event, icons_priv *ics)
-{
-    
-    ENTER;
-    g_assert(ics != NULL);
-    if (xev->type == PropertyNotify)
-	ics_propertynotify(ics, xev);
-    RET(GDK_FILTER_CONTINUE);
-}
-
-
 static void
-do_net_client_list(icons_priv *ics)
+ics_window_added(FbEv *ev, fb_client *c, icons_priv *ics)
 {
-    int i;
-    task *tk;
-    
     ENTER;
-    if (ics->wins)
-    {
-        DBG("free ics->wins\n");
-        XFree(ics->wins);
-        ics->wins = NULL;
-    }
-    ics->wins = get_xaproperty (GDK_ROOT_WINDOW(),
-        a_NET_CLIENT_LIST, XA_WINDOW, &ics->win_num);
-    if (!ics->wins) 
-	RET();
-    DBG("alloc ics->wins\n");
-    for (i = 0; i < ics->win_num; i++)
-    {
-        if ((tk = g_hash_table_lookup(ics->task_list, &ics->wins[i])))
-        {
-            tk->refcount++;
-        }
-        else
-        {
-            tk = g_new0(task, 1);
-            tk->refcount++;
-            ics->num_tasks++;
-            tk->win = ics->wins[i];
-            tk->ics = ics;
-            
-            if (!FBPANEL_WIN(tk->win))
-            {
-                XSelectInput(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win,
-                    PropertyChangeMask | StructureNotifyMask);
-            }
-            get_wmclass(tk);
-            set_icon_maybe(ics, tk);
-            g_hash_table_insert(ics->task_list, &tk->win, tk);
-        }
-    }
-    
-    /* remove windows that arn't in the NET_CLIENT_LIST anymore */
-    g_hash_table_foreach_remove(ics->task_list,
-        (GHRFunc) task_remove_stale, NULL);
+    set_icon_maybe(c, ics);
     RET();
 }
 
 static void
-ics_propertynotify(icons_priv *ics, XEvent *ev)
+ics_window_changed(FbEv *ev, fb_client *c, icons_priv *ics)
 {
-    Atom at;
-    Window win;
-
-    
     ENTER;
-    win = ev->xproperty.window;
-    at = ev->xproperty.atom;
-    DBG("win=%lx at=%ld\n", win, at);
-    if (win != GDK_ROOT_WINDOW())
-    {
-	task *tk = find_task(ics, win);
-
-        if (!tk) 
-            RET();
-        if (at == XA_WM_CLASS)
-        {
-            get_wmclass(tk);
-            set_icon_maybe(ics, tk);
-        }
-        else if (at == XA_WM_HINTS)
-        {
-            set_icon_maybe(ics, tk);
-        }  
-    }
+    DBG("win=%lx changed=%x\n", c->win, c->changed);
+    if (c->changed & (FB_CLIENT_CLASS | FB_CLIENT_HINTS))
+        set_icon_maybe(c, ics);
     RET();
 }
 
@@ -483,7 +306,7 @@ theme_changed(icons_priv *ics)
     ENTER;
     drop_config(ics);
     ics_parse_config(ics);
-    do_net_client_list(ics);
+    fb_ev_client_foreach(fbev, (GFunc) set_icon_maybe, ics);
     RET();
 }
 
@@ -494,13 +317,13 @@ icons_constructor(plugin_instance *p)
 
     ENTER;
     ics = (icons_priv *) p;
-    ics->task_list = g_hash_table_new(g_int_hash, g_int_equal);
     theme_changed(ics);
     g_signal_connect_swapped(G_OBJECT(gtk_icon_theme_get_default()),
         "changed", (GCallback) theme_changed, ics);
-    g_signal_connect_swapped(G_OBJECT (fbev), "client_list",
-        G_CALLBACK (do_net_client_list), (gpointer) ics);
-    gdk_window_add_filter(NULL, (GdkFilterFunc)ics_event_filter, ics );
+    g_signal_connect(G_OBJECT (fbev), "window_added",
+        G_CALLBACK (ics_window_added), (gpointer) ics);
+    g_signal_connect(G_OBJECT (fbev), "window_changed",
+        G_CALLBACK (ics_window_changed), (gpointer) ics);
 
     RET(1);
 }
@@ -512,13 +335,13 @@ icons_destructor(plugin_instance *p)
     icons_priv *ics = (icons_priv *) p;
     
     ENTER;
-    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev), do_net_client_list,
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev), ics_window_added,
+        ics);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev), ics_window_changed,
         ics);
     g_signal_handlers_disconnect_by_func(G_OBJECT(gtk_icon_theme_get_default()),
         theme_changed, ics);
-    gdk_window_remove_filter(NULL, (GdkFilterFunc)ics_event_filter, ics );
     drop_config(ics);
-    g_hash_table_destroy(ics->task_list);
     RET();
 }
 
@@ -5,6 +5,7 @@
 #include "panel.h"
 #include "misc.h"
 #include "plugin.h"
+#include "pixconv.h"
 
 //#define DEBUGPRN
 #include "dbg.h"
@@ -74,10 +75,9 @@ image_constructor(plugin_instance *p)
             	(float) (p->panel->ah - 2) / (float) gdk_pixbuf_get_height(gp)
             	: (float) (p->panel->aw - 2) / (float) gdk_pixbuf_get_width(gp);
 
-	gps =  gdk_pixbuf_scale_simple (gp,
+	gps =  fb_pixbuf_scale (gp,
               				ratio * ((float) gdk_pixbuf_get_width(gp)),
-              				ratio * ((float) gdk_pixbuf_get_height(gp)),
-              				GDK_INTERP_HYPER);
+              				ratio * ((float) gdk_pixbuf_get_height(gp)));
        
         //gdk_pixbuf_render_pixmap_and_mask(gps, &img->pix, &img->mask, 127);
 	gtk_container_add(container, wid);
@@ -27,43 +27,49 @@
 
 
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo-xlib.h>
 
 #include "panel.h"
 #include "misc.h"
 #include "plugin.h"
 #include "gtkbgbox.h"
+#include "blink.h"
 
 //#define DEBUGPRN
 #include "dbg.h"
 
 
 
-/* managed window: all related info that wm holds about its managed windows */
+/* managed window: all related info that wm holds about its managed windows
+ * is kept by fbev registry, here is only pager specific stuff */
+typedef struct _pager_priv  pager_priv;
+
 typedef struct _task {
     Window win;
-    int x, y;
-    guint w, h;
+    fb_client *c;
+    pager_priv *pg;
     gint refcount;
     guint stacking;
-    guint desktop;
-    char *name, *iname;
-    net_wm_state nws;
-    net_wm_window_type nwwt;
+    guint desktop;      /* desktop it was drawn on */
+    GdkRectangle area;  /* screen geometry it was drawn with */
+    unsigned int drawn:1;       /* is on desk map */
+    unsigned int shaded:1;
+    unsigned int urgent:1;
+    unsigned int blink:1;       /* drawn highlighted now */
 } task;
 
 typedef struct _desk   desk;
-typedef struct _pager_priv  pager_priv;
 
 #define MAX_DESK_NUM   20
-/* map of a desktop */
+/* map of a desktop. It is kept in retained surface, and only damaged
+ * parts of it are repainted before it is copied to screen */
 struct _desk {
     GtkWidget *da;
     Pixmap xpix;
-    //GdkPixmap *gpix;
-    //GdkPixmap *pix;
-    cairo_surface_t *gpix;
-    cairo_surface_t *pix;
-    guint no, dirty, first;
+    cairo_surface_t *gpix;      /* wallpaper thumbnail */
+    cairo_surface_t *pix;       /* wallpaper with windows on it */
+    cairo_region_t *damage;     /* part of pix to repaint */
+    guint no, first;
     gfloat scalew, scaleh;
     pager_priv *pg;
 };
@@ -77,18 +83,19 @@ struct _pager_priv {
     gint wallpaper;
     //int dw, dh;
     gfloat /*scalex, scaley, */ratio;
-    Window *wins;
-    int winnum, dirty;
+    int dirty;
     GHashTable* htable;
     task *focusedtask;
     FbBg *fbbg;
+    cairo_surface_t *thumb;     /* wallpaper thumbnail shared by desks */
+    Pixmap thumb_xpix;          /* root pixmap it was made of */
     gint dah, daw;
 };
 
 
 
 #define TASK_VISIBLE(tk)                            \
- (!( (tk)->nws.hidden || (tk)->nws.skip_pager ))
+ (!( (tk)->c->nws.hidden || (tk)->c->nws.skip_pager ))
 
 
 static void pager_rebuild_all(FbEv *ev, pager_priv *pg);
@@ -97,12 +104,11 @@ static void desk_draw_bg(pager_priv *pg, desk *d1);
 
 static void pager_destructor(plugin_instance *p);
 
-static inline void desk_set_dirty_by_win(pager_priv *p, task *t);
+static void task_damage(task *t);
+static void task_clear(task *t);
 static inline void desk_set_dirty(desk *d);
-static inline void desk_set_dirty_all(pager_priv *pg);
 
 /*
-static void desk_clear_pixmap(desk *d);
 static gboolean task_remove_stale(Window *win, task *t, pager_priv *p);
 static gboolean task_remove_all(Window *win, task *t, pager_priv *p);
 */
@@ -114,14 +120,16 @@ static pager_priv *cp;
 static void
 sig_usr(int signum)
 {
-    int j;
+    int j, winnum;
+    Window *wins;
     task *t;
 
     if (signum != SIGUSR2)
         return;
     ERR("dekstop num=%d cur_desktop=%d\n", cp->desknum, cp->curdesk);
-    for (j = 0; j < cp->winnum; j++) {
-        if (!(t = g_hash_table_lookup(cp->htable, &cp->wins[j])))
+    wins = fb_ev_client_list_stacking(fbev, &winnum);
+    for (j = 0; j < winnum; j++) {
+        if (!(t = g_hash_table_lookup(cp->htable, &wins[j])))
             continue;
         ERR("win=%x desktop=%u\n", (guint) t->win, t->desktop);
     }
@@ -135,351 +143,387 @@ sig_usr(int signum)
  *****************************************************************/
 
 
+static void
+task_blink(gboolean on, task *t)
+{
+    t->blink = on;
+    task_damage(t);
+}
+
+/* urgent window blinks in step with other urgent items, see blink.h */
+static void
+task_update_urgency(task *t)
+{
+    if (t->c->urgency && !t->urgent) {
+        t->urgent = 1;
+        fb_blink_add((fb_blink_func) task_blink, t);
+    } else if (!t->c->urgency && t->urgent) {
+        t->urgent = 0;
+        fb_blink_remove((fb_blink_func) task_blink, t);
+        if (t->blink)
+            task_blink(FALSE, t);
+    }
+}
+
+static void
+task_free(task *t)
+{
+    if (t->urgent)
+        fb_blink_remove((fb_blink_func) task_blink, t);
+    g_free(t);
+}
+
 /* tell to remove element with zero refcount */
 static gboolean
 task_remove_stale(Window *win, task *t, pager_priv *p)
 {
     if (t->refcount-- == 0) {
-        desk_set_dirty_by_win(p, t);
+        task_clear(t);
         if (p->focusedtask == t)
             p->focusedtask = NULL;
         DBG("del %lx\n", t->win);
-        g_free(t);
+        task_free(t);
         return TRUE;
     }
     return FALSE;
 }
 
-/* tell to remove element with zero refcount */
+/* tell to remove every element */
 static gboolean
 task_remove_all(Window *win, task *t, pager_priv *p)
 {
-    g_free(t);
+    if (p->focusedtask == t)
+        p->focusedtask = NULL;
+    task_free(t);
     return TRUE;
 }
 
 
-static void
-task_get_sizepos(task *t)
+static task *
+task_new(pager_priv *p, fb_client *c, guint stacking)
 {
-    Window root, junkwin;
-    int rx, ry;
-    guint dummy;
-    XWindowAttributes win_attributes;
+    task *t;
 
     ENTER;
-    if (!XGetWindowAttributes(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()) , t->win, &win_attributes)) {
-        if (!XGetGeometry (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()) , t->win, &root, &t->x, &t->y, &t->w, &t->h,
-                  &dummy, &dummy)) {
-            t->x = t->y = t->w = t->h = 2;
-        }
+    t = g_new0(task, 1);
+    t->win = c->win;
+    t->c = c;
+    t->pg = p;
+    t->stacking = stacking;
+    t->desktop = c->desktop;
+    g_hash_table_insert(p->htable, &t->win, t);
+    DBG("add %lx\n", t->win);
+    task_damage(t);
+    task_update_urgency(t);
+    RET(t);
+}
 
-    } else {
-        XTranslateCoordinates (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()) , t->win, win_attributes.root,
-              -win_attributes.border_width,
-              -win_attributes.border_width,
-              &rx, &ry, &junkwin);
-        t->x = rx;
-        t->y = ry;
-        t->w = win_attributes.width;
-        t->h = win_attributes.height;
-        DBG("win=0x%lx WxH=%dx%d\n", t->win,t->w, t->h);
-    }
-    RET();
+/* Task's rectangle on desk map, frame included. Returns FALSE if it is
+ * too small to be drawn */
+static gboolean
+task_map_rect(task *t, desk *d, GdkRectangle *r)
+{
+    r->x = (gfloat) t->area.x * d->scalew;
+    r->y = (gfloat) t->area.y * d->scaleh;
+    r->width = (gfloat) t->area.width * d->scalew;
+    r->height = t->shaded ? 3 : (gfloat) t->area.height * d->scaleh;
+    if (r->width < 3 || r->height < 3)
+        return FALSE;
+    return TRUE;
 }
 
+/* colour of desk's style in given state */
+static void
+desk_get_color(desk *d, GtkStateFlags state, GdkRGBA *color)
+{
+    GtkStyleContext *ctx = gtk_widget_get_style_context(d->da);
+
+    gtk_style_context_save(ctx);
+    gtk_style_context_set_state(ctx, state);
+    gtk_style_context_get_color(ctx, state, color);
+    gtk_style_context_restore(ctx);
+}
 
 static void
-task_update_pix(task *t, desk *d)
+task_paint(task *t, desk *d, cairo_t *cr, GdkRectangle *r)
 {
-    int x, y, w, h;
-    GtkWidget *widget;
-    GdkDrawingContext *context = NULL;
-    cairo_t *cr = NULL;
+    GdkRGBA color;
 
     ENTER;
+    desk_get_color(d, (t->blink || d->pg->focusedtask == t)
+        ? GTK_STATE_FLAG_SELECTED : GTK_STATE_FLAG_NORMAL, &color);
+    gdk_cairo_set_source_rgba(cr, &color);
+    cairo_rectangle(cr, r->x + 0.5, r->y + 0.5, r->width - 1, r->height - 1);
+    cairo_set_line_width(cr, 1);
+    cairo_stroke(cr);
+    if (!t->blink)
+        color.alpha *= 0.4;
+    gdk_cairo_set_source_rgba(cr, &color);
+    cairo_rectangle(cr, r->x + 1, r->y + 1, r->width - 2, r->height - 2);
+    cairo_fill(cr);
+    RET();
+}
 
-    g_return_if_fail(d->pix != NULL);
 
-    if (!TASK_VISIBLE(t))
-        RET();
+/*****************************************************************
+ * Desk Functions                                                *
+ *****************************************************************/
 
-    if (t->desktop < d->pg->desknum &&
-          t->desktop != d->no)
-        RET();
+/* queues part of desk map for repaint */
+static void
+desk_damage(desk *d, GdkRectangle *r)
+{
+    ENTER;
+    cairo_region_union_rectangle(d->damage, r);
+    fb_trace_mark(d->da, "pager");
+    gtk_widget_queue_draw_area(d->da, r->x, r->y, r->width, r->height);
+    RET();
+}
 
-    x = (gfloat)t->x * d->scalew;
-    y = (gfloat)t->y * d->scaleh;
-    w = (gfloat)t->w * d->scalew;
-    //h = (gfloat)t->h * d->scaleh;
-    h = (t->nws.shaded) ? 3 : (gfloat)t->h * d->scaleh;
-    
-    if (w < 3 || h < 3)
-    	RET();
-
-    widget = GTK_WIDGET(d->da);
-    
-    context = gdk_window_begin_draw_frame (gtk_widget_get_window(widget), NULL);
-    cr = gdk_drawing_context_get_cairo_context (context);
-
-    //gdk_draw_rectangle (d->pix, (d->pg->focusedtask == t) ?  gtk_widget_get_style_context(widget)/*->bg_gc[GTK_STATE_SELECTED]*/ :
-    //			gtk_widget_get_style_context(widget)/*->bg_gc[GTK_STATE_NORMAL]*/, TRUE,x+1, y+1, w-1, h-1);
-    cairo_rectangle (cr, x + 1, y + 1, w - 1, h - 1);
-    cairo_fill(cr);
-    
-    //gdk_draw_rectangle (d->pix, (d->pg->focusedtask == t) ? gtk_widget_get_style_context(widget)/*->fg_gc[GTK_STATE_SELECTED]*/ :
-    //			gtk_widget_get_style_context(widget)/*->fg_gc[GTK_STATE_NORMAL]*/, FALSE, x, y, w, h);
-    cairo_rectangle (cr, x, y, w, h);
-    cairo_fill(cr);
+/* damages task's area on desks it is drawn on */
+static void
+desk_damage_task(pager_priv *pg, task *t)
+{
+    GdkRectangle r;
+    int i;
 
-    cairo_destroy (cr);
-    
+    ENTER;
+    for (i = 0; i < pg->desknum; i++) {
+        if (t->desktop < pg->desknum && t->desktop != i)
+            continue;
+        if (task_map_rect(t, pg->desks[i], &r))
+            desk_damage(pg->desks[i], &r);
+    }
     RET();
 }
 
+/* damages map where task was drawn */
+static void
+task_clear(task *t)
+{
+    ENTER;
+    if (t->drawn)
+        desk_damage_task(t->pg, t);
+    t->drawn = 0;
+    RET();
+}
 
-/*****************************************************************
- * Desk Functions                                                *
- *****************************************************************/
+/* Takes task's current state and damages map where it was drawn and
+ * where it is to be drawn now. Window move costs two small rectangles
+ * instead of whole desk repaint */
 static void
-desk_clear_pixmap(desk *d)
+task_damage(task *t)
 {
-    GtkWidget *widget;
-    GdkDrawingContext *context;
+    ENTER;
+    task_clear(t);
+    t->desktop = t->c->desktop;
+    t->area.x = t->c->x;
+    t->area.y = t->c->y;
+    t->area.width = t->c->w;
+    t->area.height = t->c->h;
+    t->shaded = t->c->nws.shaded;
+    t->drawn = TASK_VISIBLE(t) && !t->c->nwwt.desktop;
+    if (t->drawn)
+        desk_damage_task(t->pg, t);
+    RET();
+}
+
+/* Repaints damaged part of desk map: wallpaper, then windows that
+ * intersect damage, bottom to top */
+static void
+desk_repaint(desk *d)
+{
+    pager_priv *pg = d->pg;
+    Window *wins;
+    task *t;
+    int j, winnum;
+    GdkRectangle r;
     cairo_t *cr;
-    GtkAllocation *allocation;
 
     ENTER;
-    
-
-    DBG("d->no=%d\n", d->no);
-   
-   if (!d->pix)
+    if (!d->pix || cairo_region_is_empty(d->damage))
         RET();
-   
-   widget = GTK_WIDGET(d->da);
-   allocation = g_new0 (GtkAllocation, 1);
-   gtk_widget_get_allocation(GTK_WIDGET(widget), allocation); 
-   context = gdk_window_begin_draw_frame (gtk_widget_get_window(widget), NULL);
-   cr = gdk_drawing_context_get_cairo_context (context);
-   
-   if (d->pg->wallpaper && d->xpix != None) 
-   {
-       // gdk_draw_drawable (d->pix,  gtk_widget_get_style_context(widget)/*->dark_gc[GTK_STATE_NORMAL]*/, d->gpix,
-       //       		   0, 0, 0, 0, allocation->width, allocation->height);
-       gdk_cairo_set_source_window(cr, gtk_widget_get_window(widget), 0, 0);
-       cairo_rectangle(cr, 0, 0, allocation->width, allocation->height);
-       cairo_fill(cr);
-   } 
-   else 
-   {
-        //gdk_draw_rectangle (d->pix, ((d->no == d->pg->curdesk) ? gtk_widget_get_style_context(widget)/*->dark_gc[GTK_STATE_SELECTED]*/ :
-        //            	    gtk_widget_get_style_context(widget)/*->dark_gc[GTK_STATE_NORMAL]*/), TRUE, 0, 0, allocation->width, allocation->height);
-	cairo_rectangle (cr, 0, 0, allocation->width, allocation->height);
-       cairo_fill(cr);
-   }
-   
-   if (d->pg->wallpaper && d->no == d->pg->curdesk)
-   {
-        //gdk_draw_rectangle (d->pix, gtk_widget_get_style_context(widget)/*->light_gc[GTK_STATE_SELECTED]*/, FALSE, 0, 0,
-	//		    allocation->width -1, allocation->height -1);
-   
-	cairo_rectangle (cr, 0, 0, allocation->width - 1, allocation->height - 1);
-       cairo_fill(cr);
-   }
-
-   RET();
+    DBG("d->no=%d\n", d->no);
+    cr = cairo_create(d->pix);
+    gdk_cairo_region(cr, d->damage);
+    cairo_clip(cr);
+    if (pg->wallpaper && d->gpix && d->xpix != None) {
+        cairo_set_source_surface(cr, d->gpix, 0, 0);
+        cairo_paint(cr);
+    } else {
+        cairo_set_source_rgb(cr, 0, 0, 0);
+        cairo_paint(cr);
+        gtk_render_background(gtk_widget_get_style_context(d->da), cr, 0, 0,
+            cairo_image_surface_get_width(d->pix),
+            cairo_image_surface_get_height(d->pix));
+    }
+    wins = fb_ev_client_list_stacking(fbev, &winnum);
+    for (j = 0; j < winnum; j++) {
+        if (!(t = g_hash_table_lookup(pg->htable, &wins[j])) || !t->drawn)
+            continue;
+        if (t->desktop < pg->desknum && t->desktop != d->no)
+            continue;
+        if (!task_map_rect(t, d, &r) || cairo_region_contains_rectangle(
+                d->damage, &r) == CAIRO_REGION_OVERLAP_OUT)
+            continue;
+        task_paint(t, d, cr, &r);
+    }
+    cairo_destroy(cr);
+    cairo_region_destroy(d->damage);
+    d->damage = cairo_region_create();
+    RET();
 }
 
 
+/* Scales root pixmap down to w x h thumbnail of whole screen. Scaling is
+ * done into offscreen surface on X server, which cairo does with XRender
+ * transform where available, so only thumbnail crosses the wire. Pixmap
+ * belongs to wallpaper setter and may be gone any moment, hence the
+ * error trap */
+static cairo_surface_t *
+pager_make_thumb(Pixmap xpix, int w, int h)
+{
+    GdkDisplay *display = gdk_display_get_default();
+    Display *dpy = GDK_DISPLAY_XDISPLAY(display);
+    GdkScreen *screen = gdk_display_get_default_screen(display);
+    cairo_surface_t *src, *tmp, *thumb = NULL;
+    cairo_t *cr;
+    Window root;
+    unsigned int pw, ph, bw, depth;
+    int x, y;
+    gint64 t;
+
+    ENTER;
+    gdk_x11_display_error_trap_push(display);
+    t = fb_xstat_begin();
+    if (!XGetGeometry(dpy, xpix, &root, &x, &y, &pw, &ph, &bw, &depth)
+            || depth != DefaultDepth(dpy, DefaultScreen(dpy))) {
+        fb_xstat_end(t, "GetGeometry", FB_XSTAT_HERE, 1, 32);
+        gdk_x11_display_error_trap_pop_ignored(display);
+        RET(NULL);
+    }
+    fb_xstat_end(t, "GetGeometry", FB_XSTAT_HERE, 1, 32);
+    src = cairo_xlib_surface_create(dpy, xpix,
+        DefaultVisual(dpy, DefaultScreen(dpy)), pw, ph);
+    tmp = cairo_surface_create_similar(src, CAIRO_CONTENT_COLOR, w, h);
+    cr = cairo_create(tmp);
+    cairo_scale(cr, (double) w / gdk_screen_get_width(screen),
+        (double) h / gdk_screen_get_height(screen));
+    cairo_set_source_surface(cr, src, 0, 0);
+    /* small pixmap is tiled over the screen */
+    cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    thumb = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+    cr = cairo_create(thumb);
+    cairo_set_source_surface(cr, tmp, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(tmp);
+    cairo_surface_destroy(src);
+    if (gdk_x11_display_error_trap_pop(display)) {
+        DBG("root pixmap %lx is gone\n", xpix);
+        cairo_surface_destroy(thumb);
+        RET(NULL);
+    }
+    RET(thumb);
+}
+
+/* Gives desk wallpaper thumbnail. All desks share one, which is made
+ * once per root pixmap and thumbnail size, and dropped when background
+ * changes */
 static void
 desk_draw_bg(pager_priv *pg, desk *d1)
 {
     Pixmap xpix;
-    cairo_surface_t *gpix;
-    GdkPixbuf *p1, *p2;
-    //gint width, height, depth;
-    gint width, height;
-    FbBg *bg = pg->fbbg;
-    GtkWidget *widget = d1->da;
-    GtkAllocation *da_allocation = NULL;
-
-    GtkAllocation *allocation = g_new0 (GtkAllocation, 1);
-    gtk_widget_get_allocation(GTK_WIDGET(widget), allocation); 
-    GdkDrawingContext *drawing_context = gdk_window_begin_draw_frame (gtk_widget_get_window(widget), NULL);
-    cairo_t *cr = gdk_drawing_context_get_cairo_context (drawing_context);
-
+    int width, height;
 
     ENTER;
-    if (d1->no) {
-        desk *d0 = d1->pg->desks[0];
-    	gtk_widget_get_allocation(d0->da, da_allocation);
-        if (d0->gpix && d0->xpix != None && da_allocation->width == allocation->width
-              && da_allocation->height == allocation->height) 
-	{
-            
-	    //gdk_draw_drawable(d1->gpix, widget->style->fg_gc[GTK_WIDGET_STATE (widget)], gtk_widget_get_style_context(widget),
-	    //			d0->gpix,0, 0, 0, 0, allocation->width, allocation->height);
-       	    gdk_cairo_set_source_window(cr, gtk_widget_get_window(widget), 0, 0);
-            
-	    d1->xpix = d0->xpix;
-            DBG("copy gpix from d0 to d%d\n", d1->no);
-            RET();
-        }
-    }
-    xpix = fb_bg_get_xrootpmap(bg);
+    if (d1->gpix)
+        cairo_surface_destroy(d1->gpix);
+    d1->gpix = NULL;
     d1->xpix = None;
-    width = allocation->width;
-    height = allocation->height;
+    if (!d1->pix)
+        RET();
+    width = cairo_image_surface_get_width(d1->pix);
+    height = cairo_image_surface_get_height(d1->pix);
     DBG("w %d h %d\n", width, height);
     if (width < 3 || height < 3)
         RET();
-
-    // create new pix
-    xpix = fb_bg_get_xrootpmap(bg);
+    xpix = fb_bg_get_xrootpmap(pg->fbbg);
     if (xpix == None)
         RET();
-    
-    //depth = gdk_drawable_get_depth(gtk_widget_get_window(widget));
-    //gpix = fb_bg_get_xroot_pix_for_area(bg, 0, 0, gdk_screen_width(), gdk_screen_height(), depth);
-    gpix = fb_bg_get_xroot_pix_for_area(bg, 0, 0, width, height);
-    
-    if (!gpix) 
-    {
-        ERR("fb_bg_get_xroot_pix_for_area failed\n");
-    
-    	RET();
-    }
-    
-    //p1 = gdk_pixbuf_get_from_drawable(NULL, gpix, NULL, 0, 0, 0, 0, gdk_screen_width(), gdk_screen_height());
-    p1 = gdk_pixbuf_get_from_window( gtk_widget_get_window(widget), 0, 0, width, height);
-
-    if (!p1) {
-        ERR("gdk_pixbuf_get_from_drawable failed\n");
-        goto err_gpix;
-    }
-    p2 = gdk_pixbuf_scale_simple(p1, width, height,
-          			//GDK_INTERP_NEAREST
-          			//GDK_INTERP_TILES
-          			//GDK_INTERP_BILINEAR
-          			GDK_INTERP_HYPER);
-    if (!p2)
-    {
-        ERR("gdk_pixbuf_scale_simple failed\n");
-        goto err_p1;
+    if (!pg->thumb || pg->thumb_xpix != xpix
+            || cairo_image_surface_get_width(pg->thumb) != width
+            || cairo_image_surface_get_height(pg->thumb) != height) {
+        if (pg->thumb)
+            cairo_surface_destroy(pg->thumb);
+        pg->thumb = pager_make_thumb(xpix, width, height);
+        pg->thumb_xpix = xpix;
+        DBG("new thumbnail for %lx %s\n", xpix, pg->thumb ? "ok" : "failed");
+        if (!pg->thumb)
+            RET();
     }
-    
-    //gdk_draw_pixbuf(d1->gpix, widget->style->fg_gc[GTK_WIDGET_STATE (widget)],
-    gdk_cairo_set_source_pixbuf(cr, p2, width, height);
-
+    d1->gpix = cairo_surface_reference(pg->thumb);
     d1->xpix = xpix;
-    g_object_unref(p2);
- err_p1:
-    g_object_unref(p1);
- err_gpix:
-    g_object_unref(gpix);
     RET();
 }
 
 
 
+/* whole desk map is to be repainted */
 static inline void
 desk_set_dirty(desk *d)
 {
-    ENTER;
-    d->dirty = 1;
-    gtk_widget_queue_draw(d->da);
-    RET();
-}
+    GdkRectangle r;
 
-static inline void
-desk_set_dirty_all(pager_priv *pg)
-{
-    int i;
     ENTER;
-    for (i = 0; i < pg->desknum; i++)
-        desk_set_dirty(pg->desks[i]);
-    RET();
-}
-
-static inline void
-desk_set_dirty_by_win(pager_priv *p, task *t)
-{
-    ENTER;
-    if (t->nws.skip_pager || t->nwwt.desktop /*|| t->nwwt.dock || t->nwwt.splash*/ )
+    if (!d->pix)
         RET();
-    if (t->desktop < p->desknum)
-        desk_set_dirty(p->desks[t->desktop]);
-    else
-        desk_set_dirty_all(p);
+    r.x = r.y = 0;
+    r.width = cairo_image_surface_get_width(d->pix);
+    r.height = cairo_image_surface_get_height(d->pix);
+    desk_damage(d, &r);
     RET();
 }
 
-/* Redraw the screen from the backing pixmap */
-static gint
-desk_expose_event (GtkWidget *widget, GdkEventExpose *event, desk *d)
+/* Brings map up to date and copies it to screen */
+static gboolean
+desk_draw_event(GtkWidget *widget, cairo_t *cr, desk *d)
 {
-    GdkDrawingContext *drawing_context = NULL;
-    cairo_t *cr = NULL;
- 
     ENTER;
-    DBG("d->no=%d\n", d->no);
-
-    if (d->dirty) {
-        pager_priv *pg = d->pg;
-        task *t;
-        int j;
-
-        d->dirty = 0;
-        desk_clear_pixmap(d);
-        for (j = 0; j < pg->winnum; j++) {
-            if (!(t = g_hash_table_lookup(pg->htable, &pg->wins[j])))
-                continue;
-            task_update_pix(t, d);
-        }
+    desk_repaint(d);
+    if (d->pix) {
+        cairo_set_source_surface(cr, d->pix, 0, 0);
+        cairo_paint(cr);
     }
-    
-    //gdk_draw_drawable(gtk_widget_get_window(widget), //widget->style->fg_gc[GTK_WIDGET_STATE (widget)], gtk_widget_get_style_context(widget),
-    //      		d->pix, event->area.x, event->area.y, event->area.x, event->area.y, event->area.width, event->area.height);
-
-    drawing_context = gdk_window_begin_draw_frame (gtk_widget_get_window(widget), NULL);
-    cr = gdk_drawing_context_get_cairo_context (drawing_context);
-    gdk_cairo_set_source_window(cr, gtk_widget_get_window(widget), 0, 0);
-    cairo_rectangle(cr, event->area.x, event->area.y, event->area.width, event->area.height);
-    cairo_fill(cr);
-
     RET(FALSE);
 }
 
 
-/* Upon realize and every resize creates a new backing pixmap of the appropriate size */
+/* Upon realize and every resize creates a new backing surface of the appropriate size */
 static gint
 desk_configure_event (GtkWidget *widget, GdkEventConfigure *event, desk *d)
 {
+    GdkScreen *screen = gdk_screen_get_default();
+    GtkAllocation allocation;
     int w, h;
-    
-    GtkAllocation *allocation = g_new0 (GtkAllocation, 1);
-    gtk_widget_get_allocation(GTK_WIDGET(widget), allocation);
-    GdkDisplay *display =  gdk_display_get_default();
 
     ENTER;
-    w = allocation->width;
-    h = allocation->height;
+    gtk_widget_get_allocation(widget, &allocation);
+    w = allocation.width;
+    h = allocation.height;
 
     DBG("d->no=%d %dx%d %dx%d\n", d->no, w, h, d->pg->daw, d->pg->dah);
     if (d->pix)
-        g_object_unref(d->pix);
-    if (d->gpix)
-        g_object_unref(d->gpix);
-    //d->pix = gdk_pixmap_new(gtk_widget_get_window(widget), w, h, -1);
-    d->pix = gdk_window_create_similar_surface(gtk_widget_get_window(widget),  CAIRO_CONTENT_COLOR, w, h);
-    if (d->pg->wallpaper) {
-        //d->gpix = gdk_pixmap_new(gtk_widget_get_window(widget), w, h, -1);
-        d->gpix = gdk_window_create_similar_surface(gtk_widget_get_window(widget), CAIRO_CONTENT_COLOR, w, h);
+        cairo_surface_destroy(d->pix);
+    d->pix = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+    if (d->pg->wallpaper)
         desk_draw_bg(d->pg, d);
-    }
-    d->scalew = gdk_monitor_get_scale_factor (gdk_display_get_monitor (display, 0));
-    //d->scaleh = (gfloat)w / (gfloat)gdk_screen_width();
+    d->scalew = (gfloat) w / (gfloat) gdk_screen_get_width(screen);
+    d->scaleh = (gfloat) h / (gfloat) gdk_screen_get_height(screen);
     desk_set_dirty(d);
     RET(FALSE);
 }
@@ -507,7 +551,7 @@ desk_new(pager_priv *pg, int i)
     d = pg->desks[i] = g_new0(desk, 1);
     d->pg = pg;
     d->pix = NULL;
-    d->dirty = 0;
+    d->damage = cairo_region_create();
     d->first = 1;
     d->no = i;
 
@@ -517,8 +561,8 @@ desk_new(pager_priv *pg, int i)
     gtk_widget_add_events (d->da, GDK_EXPOSURE_MASK
           | GDK_BUTTON_PRESS_MASK
           | GDK_BUTTON_RELEASE_MASK);
-    g_signal_connect (G_OBJECT (d->da), "expose_event",
-          (GCallback) desk_expose_event, (gpointer)d);
+    g_signal_connect (G_OBJECT (d->da), "draw",
+          (GCallback) desk_draw_event, (gpointer)d);
     g_signal_connect (G_OBJECT (d->da), "configure_event",
           (GCallback) desk_configure_event, (gpointer)d);
     g_signal_connect (G_OBJECT (d->da), "button_press_event",
@@ -537,9 +581,10 @@ desk_free(pager_priv *pg, int i)
     DBG("i=%d d->no=%d d->da=%p d->pix=%p\n",
           i, d->no, d->da, d->pix);
     if (d->pix)
-        g_object_unref(d->pix);
+        cairo_surface_destroy(d->pix);
     if (d->gpix)
-        g_object_unref(d->gpix);
+        cairo_surface_destroy(d->gpix);
+    cairo_region_destroy(d->damage);
     gtk_widget_destroy(d->da);
     g_free(d);
     RET();
@@ -553,25 +598,24 @@ desk_free(pager_priv *pg, int i)
 static void
 do_net_active_window(FbEv *ev, pager_priv *p)
 {
-    Window *fwin;
+    Window fwin;
     task *t;
 
     ENTER;
-    fwin = get_xaproperty(GDK_ROOT_WINDOW(), a_NET_ACTIVE_WINDOW, XA_WINDOW, 0);
-    DBG("win=%lx\n", fwin ? *fwin : 0);
-    if (fwin) {
-        t = g_hash_table_lookup(p->htable, fwin);
+    fwin = fb_ev_active_window(fbev);
+    DBG("win=%lx\n", fwin);
+    if (fwin != None) {
+        t = g_hash_table_lookup(p->htable, &fwin);
         if (t != p->focusedtask) {
             if (p->focusedtask)
-                desk_set_dirty_by_win(p, p->focusedtask);
+                task_damage(p->focusedtask);
             p->focusedtask = t;
             if (t)
-                desk_set_dirty_by_win(p, t);
+                task_damage(t);
         }
-        XFree(fwin);
     } else {
         if (p->focusedtask) {
-            desk_set_dirty_by_win(p, p->focusedtask);
+            task_damage(p->focusedtask);
             p->focusedtask = NULL;
         }
     }
@@ -586,7 +630,7 @@ do_net_current_desktop(FbEv *ev, pager_priv *pg)
     gtk_widget_set_state_flags(pg->desks[pg->curdesk]->da, GTK_STATE_FLAG_NORMAL, TRUE);
     //gtk_widget_set_state(pg->desks[pg->curdesk]->da, GTK_STATE_NORMAL);
     //pager_paint_frame(pg, pg->curdesk, GTK_STATE_NORMAL);
-    pg->curdesk =  get_net_current_desktop ();
+    pg->curdesk =  fb_ev_current_desktop(fbev);
     if (pg->curdesk >= pg->desknum)
         pg->curdesk = 0;
     desk_set_dirty(pg->desks[pg->curdesk]);
@@ -597,43 +641,119 @@ do_net_current_desktop(FbEv *ev, pager_priv *pg)
 }
 
 
+/* Finds windows that have moved in stacking order. seq holds old
+ * stacking positions in new order; the longest increasing subsequence
+ * of it is the set of windows that kept their relative order, and the
+ * rest have moved. Raising one window thus yields just that one */
 static void
-do_net_client_list_stacking(FbEv *ev, pager_priv *p)
+stacking_find_moved(const guint *seq, int n, gboolean *moved)
 {
+    int *tails, *prev;
+    int i, lo, hi, mid, len;
+
+    ENTER;
+    tails = g_new(int, n);
+    prev = g_new(int, n);
+    for (len = i = 0; i < n; i++) {
+        lo = 0;
+        hi = len;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (seq[tails[mid]] < seq[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[i] = lo ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == len)
+            len++;
+        moved[i] = TRUE;
+    }
+    for (i = len ? tails[len - 1] : -1; i >= 0; i = prev[i])
+        moved[i] = FALSE;
+    g_free(prev);
+    g_free(tails);
+    RET();
+}
+
+/* damages part of desks where two tasks overlap */
+static void
+desk_damage_overlap(pager_priv *pg, task *t1, task *t2)
+{
+    GdkRectangle r1, r2, r;
     int i;
-    task *t;
 
     ENTER;
-    if (p->wins)
-        XFree(p->wins);
-    p->wins = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_CLIENT_LIST_STACKING,
-          XA_WINDOW, &p->winnum);
-    if (!p->wins || !p->winnum)
+    for (i = 0; i < pg->desknum; i++) {
+        if (t1->desktop < pg->desknum && t1->desktop != i)
+            continue;
+        if (t2->desktop < pg->desknum && t2->desktop != i)
+            continue;
+        if (task_map_rect(t1, pg->desks[i], &r1)
+                && task_map_rect(t2, pg->desks[i], &r2)
+                && gdk_rectangle_intersect(&r1, &r2, &r))
+            desk_damage(pg->desks[i], &r);
+    }
+    RET();
+}
+
+/* Raising one window shifts stacking index of every window above it,
+ * yet only the places where it overlaps windows it went past look any
+ * different. So moved windows are found first, and only overlaps of
+ * pairs whose relative order has flipped are damaged */
+static void
+do_net_client_list_stacking(FbEv *ev, pager_priv *p)
+{
+    int i, j, winnum, n;
+    Window *wins;
+    task *t, **tasks;
+    fb_client *c;
+    guint *seq;
+    gboolean *moved;
+
+    ENTER;
+    wins = fb_ev_client_list_stacking(fbev, &winnum);
+    if (!wins || !winnum)
         RET();
 
     /* refresh existing tasks and add new */
-    for (i = 0; i < p->winnum; i++) {
-        if ((t = g_hash_table_lookup(p->htable, &p->wins[i]))) {
+    tasks = g_new(task *, winnum);
+    seq = g_new(guint, winnum);
+    for (n = i = 0; i < winnum; i++) {
+        if ((t = g_hash_table_lookup(p->htable, &wins[i]))) {
             t->refcount++;
-            if (t->stacking != i) {
-                t->stacking = i;
-                desk_set_dirty_by_win(p, t);
-            }
-        } else {
-            t = g_new0(task, 1);
+            tasks[n] = t;
+            seq[n++] = t->stacking;
+        } else if ((c = fb_ev_client_lookup(fbev, wins[i]))) {
+            /* windows unknown to registry yet will come with
+             * "window_added" */
+            t = task_new(p, c, i);
             t->refcount++;
-            t->win = p->wins[i];
-            if (!FBPANEL_WIN(t->win))
-                XSelectInput (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()) , t->win, PropertyChangeMask | StructureNotifyMask);
-            t->desktop = get_net_wm_desktop(t->win);
-            get_net_wm_state(t->win, &t->nws);
-            get_net_wm_window_type(t->win, &t->nwwt);
-            task_get_sizepos(t);
-            g_hash_table_insert(p->htable, &t->win, t);
-            DBG("add %lx\n", t->win);
-            desk_set_dirty_by_win(p, t);
         }
     }
+    moved = g_new(gboolean, n);
+    stacking_find_moved(seq, n, moved);
+    for (i = 0; i < n; i++) {
+        if (!moved[i] || !tasks[i]->drawn)
+            continue;
+        DBG("moved %lx %u\n", tasks[i]->win, seq[i]);
+        for (j = 0; j < n; j++) {
+            if (j == i || !tasks[j]->drawn)
+                continue;
+            /* pair of moved ones is seen twice */
+            if (moved[j] && j < i)
+                continue;
+            if ((seq[i] < seq[j]) != (i < j))
+                desk_damage_overlap(p, tasks[i], tasks[j]);
+        }
+    }
+    g_free(moved);
+    g_free(seq);
+    g_free(tasks);
+    for (i = 0; i < winnum; i++)
+        if ((t = g_hash_table_lookup(p->htable, &wins[i])))
+            t->stacking = i;
     /* pass throu hash table and delete stale windows */
     g_hash_table_foreach_remove(p->htable, (GHRFunc) task_remove_stale, (gpointer)p);
     RET();
@@ -659,58 +779,63 @@ pager_unmapnotify(pager_priv *p, XEvent *ev)
 }
 */
 static void
-pager_configurenotify(pager_priv *p, XEvent *ev)
+pager_window_added(FbEv *ev, fb_client *c, pager_priv *p)
 {
-    Window win = ev->xconfigure.window;
-    task *t;
+    int i, winnum;
+    Window *wins;
 
     ENTER;
-
-    if (!(t = g_hash_table_lookup(p->htable, &win)))
+    if (g_hash_table_lookup(p->htable, &c->win))
         RET();
-    DBG("win=0x%lx\n", win);
-    task_get_sizepos(t);
-    desk_set_dirty_by_win(p, t);
+    wins = fb_ev_client_list_stacking(fbev, &winnum);
+    for (i = 0; i < winnum; i++) {
+        if (wins[i] == c->win) {
+            task_new(p, c, i);
+            break;
+        }
+    }
     RET();
 }
 
 static void
-pager_propertynotify(pager_priv *p, XEvent *ev)
+pager_window_removed(FbEv *ev, fb_client *c, pager_priv *p)
 {
-    Atom at = ev->xproperty.atom;
-    Window win = ev->xproperty.window;
     task *t;
 
-
     ENTER;
-    if ((win == GDK_ROOT_WINDOW()) || !(t = g_hash_table_lookup(p->htable, &win)))
-        RET();
-
-    DBG("window=0x%lx\n", t->win);
-    if (at == a_NET_WM_STATE) {
-        DBG("event=NET_WM_STATE\n");
-        get_net_wm_state(t->win, &t->nws);
-    } else if (at == a_NET_WM_DESKTOP) {
-        DBG("event=NET_WM_DESKTOP\n");
-        desk_set_dirty_by_win(p, t); // to clean up desks where this task was
-        t->desktop = get_net_wm_desktop(t->win);
-    } else {
+    if (!(t = g_hash_table_lookup(p->htable, &c->win)))
         RET();
-    }
-    desk_set_dirty_by_win(p, t);
+    task_clear(t);
+    if (p->focusedtask == t)
+        p->focusedtask = NULL;
+    g_hash_table_remove(p->htable, &c->win);
+    DBG("del %lx\n", t->win);
+    task_free(t);
     RET();
 }
 
-static GdkFilterReturn
-pager_event_filter( XEvent *xev, GdkEvent *event, pager_priv *pg)
+static void
+pager_window_changed(FbEv *ev, fb_client *c, pager_priv *p)
 {
+    task *t;
+
     ENTER;
-    if (xev->type == PropertyNotify )
-        pager_propertynotify(pg, xev);
-    else if (xev->type == ConfigureNotify )
-        pager_configurenotify(pg, xev);
-    RET(GDK_FILTER_CONTINUE);
+    if (!(c->changed & (FB_CLIENT_STATE | FB_CLIENT_TYPE
+                  | FB_CLIENT_DESKTOP | FB_CLIENT_GEOMETRY
+                  | FB_CLIENT_HINTS)))
+        RET();
+    if (!(t = g_hash_table_lookup(p->htable, &c->win)))
+        RET();
+    if (c->changed & FB_CLIENT_HINTS) {
+        task_update_urgency(t);
+        if (!(c->changed & ~FB_CLIENT_HINTS))
+            RET();
+    }
+    DBG("window=0x%lx changed=%x\n", t->win, c->changed);
+    task_damage(t);
+    RET();
 }
+
 #if 0
 static void
 pager_paint_frame(pager_priv *pg, gint no, GtkStateType state)
@@ -752,6 +877,10 @@ pager_bg_changed(FbBg *bg, pager_priv *pg)
     int i;
 
     ENTER;
+    if (pg->thumb) {
+        cairo_surface_destroy(pg->thumb);
+        pg->thumb = NULL;
+    }
     for (i = 0; i < pg->desknum; i++) {
         desk *d = pg->desks[i];
         desk_draw_bg(pg, d);
@@ -771,14 +900,14 @@ pager_rebuild_all(FbEv *ev, pager_priv *pg)
     desknum = pg->desknum;
     curdesk = pg->curdesk;
 
-    pg->desknum = get_net_number_of_desktops();
+    pg->desknum = fb_ev_number_of_desktops(fbev);
     if (pg->desknum < 1)
         pg->desknum = 1;
     else if (pg->desknum > MAX_DESK_NUM) {
         pg->desknum = MAX_DESK_NUM;
         ERR("pager: max number of supported desks is %d\n", MAX_DESK_NUM);
     }
-    pg->curdesk = get_net_current_desktop();
+    pg->curdesk = fb_ev_current_desktop(fbev);
     if (pg->curdesk >= pg->desknum)
         pg->curdesk = 0;
     DBG("desknum=%d curdesk=%d\n", desknum, curdesk);
@@ -797,8 +926,11 @@ pager_rebuild_all(FbEv *ev, pager_priv *pg)
             desk_new(pg, i);
     }
     g_hash_table_foreach_remove(pg->htable, (GHRFunc) task_remove_all, (gpointer)pg);
+    for (i = 0; i < pg->desknum; i++)
+        desk_set_dirty(pg->desks[i]);
     do_net_current_desktop(NULL, pg);
     do_net_client_list_stacking(NULL, pg);
+    do_net_active_window(NULL, pg);
 
     RET();
 }
@@ -828,8 +960,8 @@ pager_constructor(plugin_instance *plug)
     gtk_container_set_border_width (GTK_CONTAINER (plug->pwid), BORDER);
     gtk_container_add(GTK_CONTAINER(plug->pwid), pg->box);
 
-    //pg->ratio = (gfloat)gdk_screen_width() / (gfloat)gdk_screen_height();
-    pg->ratio = gdk_monitor_get_scale_factor (gdk_display_get_monitor (display, 0));
+    pg->ratio = (gfloat) gdk_screen_get_width(gdk_display_get_default_screen(display))
+        / (gfloat) gdk_screen_get_height(gdk_display_get_default_screen(display));
 
     if (plug->panel->orientation == GTK_ORIENTATION_HORIZONTAL) {
         pg->dah = plug->panel->ah - 2 * BORDER;
@@ -850,8 +982,6 @@ pager_constructor(plugin_instance *plug)
     }
     pager_rebuild_all(fbev, pg);
 
-    gdk_window_add_filter(NULL, (GdkFilterFunc)pager_event_filter, pg );
-
     g_signal_connect (G_OBJECT (fbev), "current_desktop",
           G_CALLBACK (do_net_current_desktop), (gpointer) pg);
     g_signal_connect (G_OBJECT (fbev), "active_window",
@@ -860,6 +990,12 @@ pager_constructor(plugin_instance *plug)
           G_CALLBACK (pager_rebuild_all), (gpointer) pg);
     g_signal_connect (G_OBJECT (fbev), "client_list_stacking",
           G_CALLBACK (do_net_client_list_stacking), (gpointer) pg);
+    g_signal_connect (G_OBJECT (fbev), "window_added",
+          G_CALLBACK (pager_window_added), (gpointer) pg);
+    g_signal_connect (G_OBJECT (fbev), "window_changed",
+          G_CALLBACK (pager_window_changed), (gpointer) pg);
+    g_signal_connect (G_OBJECT (fbev), "window_removed",
+          G_CALLBACK (pager_window_removed), (gpointer) pg);
     RET(1);
 }
 
@@ -877,7 +1013,12 @@ pager_destructor(plugin_instance *p)
             pager_rebuild_all, pg);
     g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
             do_net_client_list_stacking, pg);
-    gdk_window_remove_filter(NULL, (GdkFilterFunc)pager_event_filter, pg);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
+            pager_window_added, pg);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
+            pager_window_changed, pg);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
+            pager_window_removed, pg);
     while (pg->desknum--) {
         desk_free(pg, pg->desknum);
     }
@@ -891,8 +1032,8 @@ pager_destructor(plugin_instance *p)
         DBG("put fbbg %p\n", pg->fbbg);
         g_object_unref(pg->fbbg);
     }
-    if (pg->wins)
-        XFree(pg->wins);
+    if (pg->thumb)
+        cairo_surface_destroy(pg->thumb);
     RET();
 }
 
@@ -26,9 +26,15 @@
 #include <gtk/gtk.h>
 #include "eggtraymanager.h"
 #include "eggmarshalers.h"
+#include "panel.h"
+#include "xev.h"
 
 //#define DEBUGPRN
 #include "dbg.h"
+Atom a_NET_SYSTEM_TRAY_OPCODE;
+Atom a_NET_SYSTEM_TRAY_MESSAGE_DATA;
+Atom a_MANAGER;
+
 /* Signals */
 enum
 {
@@ -446,32 +452,40 @@ egg_tray_manager_handle_event (EggTrayManager       *manager,
 }
 
 static GdkFilterReturn
-egg_tray_manager_window_filter (GdkXEvent *xev, GdkEvent *event, gpointer data)
+egg_tray_manager_opcode_filter (XEvent *xevent, EggTrayManager *manager)
 {
-  XEvent *xevent = (GdkXEvent *)xev;
-  EggTrayManager *manager = data;
+  return egg_tray_manager_handle_event (manager, (XClientMessageEvent *)xevent);
+}
 
-  if (xevent->type == ClientMessage)
-    {
-      if (xevent->xclient.message_type == manager->opcode_atom)
-	{
-	  return egg_tray_manager_handle_event (manager, (XClientMessageEvent *)xevent);
-	}
-      else if (xevent->xclient.message_type == manager->message_data_atom)
-	{
-	  egg_tray_manager_handle_message_data (manager, (XClientMessageEvent *)xevent);
-	  return GDK_FILTER_REMOVE;
-	}
-    }
-  else if (xevent->type == SelectionClear)
-    {
-      g_signal_emit (manager, manager_signals[LOST_SELECTION], 0);
-      egg_tray_manager_unmanage (manager);
-    }
-  
+static GdkFilterReturn
+egg_tray_manager_message_data_filter (XEvent *xevent, EggTrayManager *manager)
+{
+  egg_tray_manager_handle_message_data (manager, (XClientMessageEvent *)xevent);
+  return GDK_FILTER_REMOVE;
+}
+
+static GdkFilterReturn
+egg_tray_manager_selection_clear_filter (XEvent *xevent, EggTrayManager *manager)
+{
+  g_signal_emit (manager, manager_signals[LOST_SELECTION], 0);
+  egg_tray_manager_unmanage (manager);
   return GDK_FILTER_CONTINUE;
 }
 
+static void
+egg_tray_manager_set_filters (EggTrayManager *manager, Window xwin, gboolean add)
+{
+  void (*fn) (Window, int, Atom, fb_xev_func, gpointer);
+
+  fn = add ? fb_xev_add : fb_xev_remove;
+  fn (xwin, ClientMessage, manager->opcode_atom,
+      (fb_xev_func) egg_tray_manager_opcode_filter, manager);
+  fn (xwin, ClientMessage, manager->message_data_atom,
+      (fb_xev_func) egg_tray_manager_message_data_filter, manager);
+  fn (xwin, SelectionClear, None,
+      (fb_xev_func) egg_tray_manager_selection_clear_filter, manager);
+}
+
 static void
 egg_tray_manager_unmanage (EggTrayManager *manager)
 {
@@ -498,7 +512,7 @@ egg_tray_manager_unmanage (EggTrayManager *manager)
       XSetSelectionOwner (display, manager->selection_atom, None, timestamp);
     }
 
-  gdk_window_remove_filter (gtk_widget_get_window(invisible), egg_tray_manager_window_filter, manager);  
+  egg_tray_manager_set_filters (manager, GDK_WINDOW_XID (gtk_widget_get_window(invisible)), FALSE);
 
   manager->invisible = NULL; /* prior to destroy for reentrancy paranoia */
   gtk_widget_destroy (invisible);
@@ -551,7 +565,7 @@ egg_tray_manager_manage_xscreen (EggTrayManager *manager, Screen *xscreen)
 
       xev.type = ClientMessage;
       xev.window = RootWindowOfScreen (xscreen);
-      xev.message_type = XInternAtom (DisplayOfScreen (xscreen), "MANAGER", False);
+      xev.message_type = a_MANAGER;
 
       xev.format = 32;
       xev.data.l[0] = timestamp;
@@ -568,16 +582,11 @@ egg_tray_manager_manage_xscreen (EggTrayManager *manager, Screen *xscreen)
       manager->invisible = invisible;
       g_object_ref (G_OBJECT (manager->invisible));
       
-      manager->opcode_atom = XInternAtom (DisplayOfScreen (xscreen),
-					  "_NET_SYSTEM_TRAY_OPCODE",
-					  False);
-
-      manager->message_data_atom = XInternAtom (DisplayOfScreen (xscreen),
-						"_NET_SYSTEM_TRAY_MESSAGE_DATA",
-						False);
+      manager->opcode_atom = a_NET_SYSTEM_TRAY_OPCODE;
+      manager->message_data_atom = a_NET_SYSTEM_TRAY_MESSAGE_DATA;
 
       /* Add a window filter */
-      gdk_window_add_filter (gtk_widget_get_window(invisible), egg_tray_manager_window_filter, manager);
+      egg_tray_manager_set_filters (manager, GDK_WINDOW_XID (gtk_widget_get_window(invisible)), TRUE);
       return TRUE;
     }
   else
@@ -643,10 +652,8 @@ egg_tray_manager_get_child_title (EggTrayManager *manager,
   child_window = g_object_get_data (G_OBJECT (child),
         "egg-tray-child-window");
   
-  //utf8_string = XInternAtom (GDK_DISPLAY (), "UTF8_STRING", False);
-  utf8_string = XInternAtom (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), "UTF8_STRING", False);
-  //atom = XInternAtom (GDK_DISPLAY (), "_NET_WM_NAME", False);
-  atom = XInternAtom (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), "_NET_WM_NAME", False);
+  utf8_string = a_UTF8_STRING;
+  atom = a_NET_WM_NAME;
   
   gdk_error_trap_push();
 
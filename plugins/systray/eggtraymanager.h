@@ -37,6 +37,11 @@ typedef struct _EggTrayManager	     EggTrayManager;
 typedef struct _EggTrayManagerClass  EggTrayManagerClass;
 typedef struct _EggTrayManagerChild  EggTrayManagerChild;
 
+/* interned by panel before the plugin starts, see tray_atoms in main.c */
+extern Atom a_NET_SYSTEM_TRAY_OPCODE;
+extern Atom a_NET_SYSTEM_TRAY_MESSAGE_DATA;
+extern Atom a_MANAGER;
+
 struct _EggTrayManager
 {
   GObject parent_instance;
@@ -175,6 +175,13 @@ tray_constructor(plugin_instance *p)
 }
 
 
+static fb_atom tray_atoms[] = {
+    { &a_NET_SYSTEM_TRAY_OPCODE,       "_NET_SYSTEM_TRAY_OPCODE" },
+    { &a_NET_SYSTEM_TRAY_MESSAGE_DATA, "_NET_SYSTEM_TRAY_MESSAGE_DATA" },
+    { &a_MANAGER,                      "MANAGER" },
+    { NULL, NULL }
+};
+
 static plugin_class class = {
     .count       = 0,
     .type        = "tray",
@@ -185,5 +192,6 @@ static plugin_class class = {
 
     .constructor = tray_constructor,
     .destructor = tray_destructor,
+    .atoms = tray_atoms,
 };
 static plugin_class *class_ptr = (plugin_class *) &class;
@@ -18,6 +18,9 @@
 #include "plugin.h"
 #include "data/images/default.xpm"
 #include "gtkbar.h"
+#include "pixconv.h"
+#include "iconcache.h"
+#include "blink.h"
 
 /*
  * 2006.09.10 modified by Hong Jen Yee (PCMan) pcman.tw (AT) gmail.com
@@ -29,40 +32,63 @@
 #include "dbg.h"
 
 struct _taskbar;
+struct _tgroup;
 typedef struct _task{
     struct _taskbar *tb;
+    struct _tgroup *group;      /* set when tasks are grouped by class */
     Window win;
+    fb_client *c;
     char *name, *iname;
     GtkWidget *button, *label, *eb;
     GtkWidget *image;
     GdkPixbuf *pixbuf;
+    GCancellable *icon_cancel;  /* set while icon is being decoded */
 
-    int refcount;
-    XClassHint ch;
     int pos_x;
     int width;
     guint desktop;
-    net_wm_state nws;
-    net_wm_window_type nwwt;
-    guint flash_timeout;
+    guint relabel_timeout;      /* trailing title update */
+    gint64 relabel_time;        /* when title was last taken */
     unsigned int focused:1;
     unsigned int iconified:1;
     unsigned int urgency:1;
     unsigned int using_netwm_icon:1;
     unsigned int flash:1;
     unsigned int flash_state:1;
+    unsigned int shown:1;           /* button state as last displayed */
+    unsigned int shown_focused:1;
 } task;
 
+/* Tasks of one application, shown as single button with member count.
+ * Used in "groupbyclass" mode, where it caps number of buttons at number
+ * of running applications */
+typedef struct _tgroup{
+    struct _taskbar *tb;
+    char *res_class;            /* hash key */
+    char *name;
+    GList *tasks;               /* all members */
+    int nshown;                 /* members that pass task_visible */
+    int nflash;                 /* members with urgency hint */
+    task *icon_tk;              /* member whose icon group shows */
+    GtkWidget *button, *image, *label, *badge;
+    int shown_count;            /* button state as last displayed */
+    unsigned int shown_focused:1;
+    unsigned int flash_state:1;
+} tgroup;
+
 
 
 typedef struct _taskbar{
     plugin_instance plugin;
-    Window *wins;
     Window topxwin;
-    int win_num;
     GHashTable  *task_list;
+    GHashTable  *desk_tasks;    /* desktop -> GList of its tasks */
+    GHashTable  *groups;        /* res_class -> tgroup, if grouping */
     GtkWidget *hbox, *bar, *space, *menu;
+    GtkWidget *group_menu;      /* list of group members */
     GdkPixbuf *gen_pixbuf;
+    GSList *pool;       /* hidden task buttons ready for reuse */
+    int pool_len;
     GtkStateType normal_state;
     GtkStateType focused_state;
     int num_tasks;
@@ -75,7 +101,7 @@ typedef struct _taskbar{
     task *focused;
     task *ptk;
     task *menutask;
-    char **desk_names;
+    char **desk_names;  /* owned by fbev */
     int desk_namesno;
     int desk_num;
     guint dnd_activate;
@@ -92,9 +118,16 @@ typedef struct _taskbar{
     int icons_only;
     int use_mouse_wheel;
     int use_urgency_hint;
+    int relabel_interval;       /* ms between title updates of a task */
+    int group_by_class;
     int discard_release_event;
 } taskbar_priv;
 
+/* title updates: applied, dropped as same, deferred by rate limit.
+ * Totals of all taskbars, registered while any of them exists */
+static gulong titles_relabeled, titles_unchanged, titles_deferred;
+static int titles_users;
+
 
 static gchar *taskbar_rc = "style 'taskbar-style'\n"
 "{\n"
@@ -116,9 +149,9 @@ static gboolean use_net_active=FALSE;
 #define TASK_WIDTH_MAX   200
 #define TASK_HEIGHT_MAX  28
 #define TASK_PADDING     4
+/* unused task buttons kept for reuse */
+#define TASK_POOL_MAX    16
 static void tk_display(taskbar_priv *tb, task *tk);
-static void tb_propertynotify(taskbar_priv *tb, XEvent *ev);
-static GdkFilterReturn tb_event_filter( XEvent *, GdkEvent *, taskbar_priv *);
 static void taskbar_destructor(plugin_instance *p);
 
 static gboolean tk_has_urgency( task* tk );
@@ -126,6 +159,13 @@ static gboolean tk_has_urgency( task* tk );
 static void tk_flash_window( task *tk );
 static void tk_unflash_window( task *tk );
 static void tk_raise_window( task *tk, guint32 time );
+static void tk_cancel_icon(task *tk);
+static void tk_build_gui(taskbar_priv *tb, task *tk);
+static void tk_release_gui(taskbar_priv *tb, task *tk);
+static void grp_task_update(taskbar_priv *tb, task *tk, gboolean visible);
+static void grp_set_names(tgroup *g);
+static void grp_flash(tgroup *g, int delta);
+static void grp_remove(taskbar_priv *tb, task *tk);
 
 #define TASK_VISIBLE(tb, tk) \
  ((tk)->desktop == (tb)->cur_desk || (tk)->desktop == -1 /* 0xFFFFFFFF */ )
@@ -189,27 +229,43 @@ tk_get_names(task *tk)
 
     ENTER;
     tk_free_names(tk);
-    name = get_utf8_property(tk->win,  a_NET_WM_NAME);
-    DBG("a_NET_WM_NAME:%s\n", name);
-    if (!name) {
-        name = get_textproperty(tk->win,  XA_WM_NAME);
-        DBG("XA_WM_NAME:%s\n", name);
-    }
+    name = tk->c->name;
+    DBG("name:%s\n", name);
     if (name) {
         tk->name = g_strdup_printf(" %s ", name);
         tk->iname = g_strdup_printf("[%s]", name);
-        g_free(name);
         tk->tb->alloc_no++;
     }
     RET();
 }
 
+/* tells whether title shown by task differs from window's one */
+static gboolean
+tk_name_changed(task *tk)
+{
+    const char *name = tk->c->name;
+    size_t len;
+
+    if (!name || !tk->name)
+        return (!name) != (!tk->name);
+    len = strlen(name);
+    return strlen(tk->name) != len + 2 || strncmp(tk->name + 1, name, len);
+}
+
 static void
 tk_set_names(task *tk)
 {
     char *name;
 
     ENTER;
+    if (tk->group) {
+        /* group shows member's title only while it is the only one */
+        if (tk->shown && tk->group->nshown == 1)
+            grp_set_names(tk->group);
+        RET();
+    }
+    if (!tk->button)
+        RET();
     name = tk->iconified ? tk->iname : tk->name;
     if (!tk->tb->icons_only)
         gtk_label_set_text(GTK_LABEL(tk->label), name);
@@ -218,6 +274,56 @@ tk_set_names(task *tk)
     RET();
 }
 
+static void
+tk_relabel(task *tk)
+{
+    ENTER;
+    tk->relabel_time = g_get_monotonic_time();
+    if (!tk_name_changed(tk)) {
+        titles_unchanged++;
+        RET();
+    }
+    titles_relabeled++;
+    tk_get_names(tk);
+    tk_set_names(tk);
+    RET();
+}
+
+static gboolean
+tk_relabel_timeout(task *tk)
+{
+    ENTER;
+    tk->relabel_timeout = 0;
+    tk_relabel(tk);
+    RET(FALSE);
+}
+
+/* Window changed its title. Apps that show progress there may do it
+ * many times a second, and every relabel costs text relayout, so at
+ * most one update per relabel_interval is done; last title always
+ * makes it after the interval */
+static void
+tk_title_changed(taskbar_priv *tb, task *tk)
+{
+    gint64 wait;
+
+    ENTER;
+    if (tk->relabel_timeout) {
+        titles_deferred++;
+        RET();
+    }
+    wait = tk->relabel_time + tb->relabel_interval * 1000
+        - g_get_monotonic_time();
+    if (!tk->button || wait <= 0) {
+        tk_relabel(tk);
+        RET();
+    }
+    titles_deferred++;
+    tk->relabel_timeout = g_timeout_add(wait / 1000 + 1,
+        (GSourceFunc) tk_relabel_timeout, tk);
+    RET();
+}
+
 
 
 static task *
@@ -227,19 +333,52 @@ find_task (taskbar_priv * tb, Window win)
     RET(g_hash_table_lookup(tb->task_list, &win));
 }
 
+/* Per-desktop index, so desktop switch touches only tasks of old and
+ * new desktops. Sticky tasks are listed under desktop -1 */
+static void
+tb_index_add(taskbar_priv *tb, task *tk)
+{
+    GList *l;
+
+    ENTER;
+    l = g_hash_table_lookup(tb->desk_tasks, GUINT_TO_POINTER(tk->desktop));
+    g_hash_table_insert(tb->desk_tasks, GUINT_TO_POINTER(tk->desktop),
+        g_list_prepend(l, tk));
+    RET();
+}
+
+static void
+tb_index_remove(taskbar_priv *tb, task *tk)
+{
+    GList *l;
+
+    ENTER;
+    l = g_hash_table_lookup(tb->desk_tasks, GUINT_TO_POINTER(tk->desktop));
+    if ((l = g_list_remove(l, tk)))
+        g_hash_table_insert(tb->desk_tasks, GUINT_TO_POINTER(tk->desktop), l);
+    else
+        g_hash_table_remove(tb->desk_tasks, GUINT_TO_POINTER(tk->desktop));
+    RET();
+}
+
 
 static void
 del_task (taskbar_priv * tb, task *tk, int hdel)
 {
     ENTER;
     DBG("deleting(%d)  %08x %s\n", hdel, tk->win, tk->name);
-    if (tk->flash_timeout)
-        g_source_remove(tk->flash_timeout);
-    gtk_widget_destroy(tk->button);
-    tb->num_tasks--;
-    tk_free_names(tk);
+    if (tk->relabel_timeout)
+        g_source_remove(tk->relabel_timeout);
+    tk_cancel_icon(tk);
     if (tb->focused == tk)
         tb->focused = NULL;
+    tk_release_gui(tb, tk);
+    grp_remove(tb, tk);
+    tb_index_remove(tb, tk);
+    tb->num_tasks--;
+    tk_free_names(tk);
+    if (tk->pixbuf)
+        g_object_unref(tk->pixbuf);
     if (hdel)
         g_hash_table_remove(tb->task_list, &tk->win);
     g_free(tk);
@@ -248,141 +387,126 @@ del_task (taskbar_priv * tb, task *tk, int hdel)
 
 
 
-static GdkVisual*
-get_cmap (cairo_surface_t *pixmap)
+/* sub-icons looked at before giving up on finding better match */
+#define NETWM_ICON_MAX   16
+/* biggest icon side, of sub-icon or pixmap, taken as sane */
+#define NETWM_ICON_SIDE  1024
+
+/* Fetches whole pixmap as client side image. Pixmap belongs to another
+ * client and may be gone by now, so errors are trapped. Icon pixmaps are
+ * small, a plain GetImage is cheaper than setting up shared memory */
+static XImage *
+get_pixmap_image(Pixmap xpixmap, unsigned int *w, unsigned int *h,
+    unsigned int *depth)
 {
-  //GdkScreen *screen = gtk_widget_get_screen (pixmap);
-  GdkScreen *screen = gdk_screen_get_default();
-  GdkVisual *cmap = gdk_screen_get_rgba_visual (screen);
-  
-  ENTER;
-  //cmap = gdk_drawable_get_colormap (pixmap);
-  if (cmap)
-    g_object_ref (G_OBJECT (cmap));
+    Display *dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+    XImage *img = NULL;
+    Window root;
+    unsigned int bw;
+    int x, y;
+    gint64 t;
 
-  if (cmap == NULL)
-    {
-      //if (gdk_drawable_get_depth (pixmap) == 1)
-      if (pixmap)
-        {
-          /* try null cmap */
-          cmap = NULL;
-        }
-      else
-        {
-          /* Try system cmap */
-          //*screen = gdk_drawable_get_screen (GDK_DRAWABLE (pixmap));
-          //cmap = gdk_screen_get_system_colormap (screen);
-          g_object_ref (G_OBJECT (cmap));
+    ENTER;
+    *w = *h = *depth = 0;
+    gdk_x11_display_error_trap_push(gdk_display_get_default());
+    t = fb_xstat_begin();
+    if (XGetGeometry(dpy, xpixmap, &root, &x, &y, w, h, &bw, depth)) {
+        fb_xstat_end(t, "GetGeometry", FB_XSTAT_HERE, 1, 32);
+        if (*w > 0 && *h > 0 && *w <= NETWM_ICON_SIDE
+            && *h <= NETWM_ICON_SIDE) {
+            t = fb_xstat_begin();
+            img = XGetImage(dpy, xpixmap, 0, 0, *w, *h, AllPlanes, ZPixmap);
+            fb_xstat_end(t, "GetImage", FB_XSTAT_HERE, 1,
+                32 + (img ? (gulong) img->bytes_per_line * img->height : 0));
         }
+    } else
+        fb_xstat_end(t, "GetGeometry", FB_XSTAT_HERE, 1, 0);
+    if (gdk_x11_display_error_trap_pop(gdk_display_get_default()) && img) {
+        XDestroyImage(img);
+        img = NULL;
     }
-
-  /* Be sure we aren't going to blow up due to visual mismatch */
-  //if (cmap &&
-      //(gdk_colormap_get_visual (cmap)->depth !=
-      // gdk_drawable_get_depth (pixmap)))
-    if (cmap)
-    cmap = NULL;
-
-  RET(cmap);
+    DBG("pixmap %lx: %ux%u depth %u %s\n", xpixmap, *w, *h, *depth,
+        img ? "ok" : "failed");
+    RET(img);
 }
-static GdkPixbuf*
-_wnck_gdk_pixbuf_get_from_pixmap (GdkPixbuf   *dest,
-                                  Pixmap       xpixmap,
-                                  int          src_x,
-                                  int          src_y,
-                                  int          dest_x,
-                                  int          dest_y,
-                                  int          width,
-                                  int          height)
-{
-    GdkWindow *window;
-    GdkPixbuf *retval;
-    GdkVisual *visual;
-
-    ENTER;
-    retval = NULL;
-
-    //surface = gdk_xid_table_lookup (xpixmap);
-    Window xWindow = GDK_ROOT_WINDOW ();
-    window = gdk_x11_window_lookup_for_display (gdk_display_get_default (),xWindow);
-
-    if (window)
-        g_object_ref (G_OBJECT (window));
-    //else
-      //  window = gdk_pixmap_foreign_new (xpixmap);
-
-    visual = get_cmap (NULL);
 
-    /* GDK is supposed to do this but doesn't in GTK 2.0.2,
-     * fixed in 2.0.3
-     */
-    //if (width < 0)
-      //  gdk_drawable_get_size (drawable, &width, NULL);
-    //if (height < 0)
-      //  gdk_drawable_get_size (drawable, NULL, &height);
-
-    //retval = gdk_pixbuf_get_from_drawable (dest, drawable, visual, src_x, src_y, dest_x, dest_y, width, height);
-    retval = gdk_pixbuf_get_from_window(window, 0, 0, width, height);
-
-    if (visual)
-        g_object_unref (G_OBJECT (window));
-    g_object_unref (G_OBJECT (visual));
-
-    RET(retval);
+/* shift and width of colour channel mask */
+static void
+mask_shift(gulong mask, int *shift, int *bits)
+{
+    *shift = *bits = 0;
+    if (!mask)
+        return;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        (*shift)++;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        (*bits)++;
+    }
 }
 
-static GdkPixbuf*
-apply_mask (GdkPixbuf *pixbuf,
-            GdkPixbuf *mask)
+static inline guchar
+channel(gulong pixel, gulong mask, int shift, int bits)
 {
-  int w, h;
-  int i, j;
-  GdkPixbuf *with_alpha;
-  guchar *src;
-  guchar *dest;
-  int src_stride;
-  int dest_stride;
+    gulong v = (pixel & mask) >> shift;
 
-  ENTER;
-  w = MIN (gdk_pixbuf_get_width (mask), gdk_pixbuf_get_width (pixbuf));
-  h = MIN (gdk_pixbuf_get_height (mask), gdk_pixbuf_get_height (pixbuf));
-
-  with_alpha = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
-
-  dest = gdk_pixbuf_get_pixels (with_alpha);
-  src = gdk_pixbuf_get_pixels (mask);
-
-  dest_stride = gdk_pixbuf_get_rowstride (with_alpha);
-  src_stride = gdk_pixbuf_get_rowstride (mask);
-
-  i = 0;
-  while (i < h)
-    {
-      j = 0;
-      while (j < w)
-        {
-          guchar *s = src + i * src_stride + j * 3;
-          guchar *d = dest + i * dest_stride + j * 4;
+    if (bits >= 8)
+        return v >> (bits - 8);
+    return bits ? v * 255 / ((1UL << bits) - 1) : 0;
+}
 
-          /* s[0] == s[1] == s[2], they are 255 if the bit was set, 0
-           * otherwise
-           */
-          if (s[0] == 0)
-            d[3] = 0;   /* transparent */
-          else
-            d[3] = 255; /* opaque */
+/* Converts pixmap image to RGBA and applies mask in the same pass.
+ * Depth 1 pixmaps are bitmaps, drawn black on white as WM would do.
+ * Runs in worker thread: XImage is plain client memory */
+static GdkPixbuf *
+ximage_to_pixbuf(XImage *img, XImage *mask, gulong rmask, gulong gmask,
+    gulong bmask)
+{
+    GdkPixbuf *pixbuf;
+    guchar *pixels, *d;
+    int x, y, stride, rs, rb, gs, gb, bs, bb;
+    gboolean direct;
+    gulong p;
 
-          ++j;
+    ENTER;
+    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, img->width,
+        img->height);
+    if (!pixbuf)
+        RET(NULL);
+    pixels = gdk_pixbuf_get_pixels(pixbuf);
+    stride = gdk_pixbuf_get_rowstride(pixbuf);
+    mask_shift(rmask, &rs, &rb);
+    mask_shift(gmask, &gs, &gb);
+    mask_shift(bmask, &bs, &bb);
+    /* common 24 and 32 bit case reads pixels in place */
+    direct = img->bits_per_pixel == 32 && img->byte_order ==
+        (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst);
+    for (y = 0; y < img->height; y++) {
+        d = pixels + y * stride;
+        for (x = 0; x < img->width; x++, d += 4) {
+            if (direct)
+                p = ((guint32 *) (img->data + y * img->bytes_per_line))[x];
+            else
+                p = XGetPixel(img, x, y);
+            if (img->depth == 1)
+                d[0] = d[1] = d[2] = p ? 0 : 255;
+            else {
+                d[0] = channel(p, rmask, rs, rb);
+                d[1] = channel(p, gmask, gs, gb);
+                d[2] = channel(p, bmask, bs, bb);
+            }
+            if (!mask || (x < mask->width && y < mask->height
+                    && XGetPixel(mask, x, y)))
+                d[3] = 255;
+            else
+                d[3] = 0;
         }
-
-      ++i;
     }
-
-  RET(with_alpha);
+    RET(pixbuf);
 }
 
-
 static void
 free_pixels (guchar *pixels, gpointer data)
 {
@@ -395,33 +519,11 @@ free_pixels (guchar *pixels, gpointer data)
 static guchar *
 argbdata_to_pixdata (gulong *argb_data, int len)
 {
-    guchar *p, *ret;
-    int i;
+    guchar *ret;
 
     ENTER;
-    ret = p = g_new (guchar, len * 4);
-    if (!ret)
-        RET(NULL);
-    /* One could speed this up a lot. */
-    i = 0;
-    while (i < len) {
-        guint32 argb;
-        guint32 rgba;
-
-        argb = argb_data[i];
-        rgba = (argb << 8) | (argb >> 24);
-
-        *p = rgba >> 24;
-        ++p;
-        *p = (rgba >> 16) & 0xff;
-        ++p;
-        *p = (rgba >> 8) & 0xff;
-        ++p;
-        *p = rgba & 0xff;
-        ++p;
-
-        ++i;
-    }
+    ret = g_new (guchar, len * 4);
+    fb_argb_to_rgba(argb_data, ret, len);
     RET(ret);
 }
 
@@ -446,135 +548,226 @@ gdk_pixbuf_scale_ratio(GdkPixbuf *p, int width, int height, GdkInterpType itype)
 
 
 
-static GdkPixbuf *
-get_netwm_icon(Window tkwin, int iw, int ih)
+/* Tells whether w x h icon is better for iw x ih slot than bw x bh one:
+ * exact size wins, then smallest of those that need no upscaling, then
+ * biggest of the rest */
+static gboolean
+netwm_icon_better(int w, int h, int bw, int bh, int iw, int ih)
 {
-    gulong *data;
-    GdkPixbuf *ret = NULL;
-    int n;
-    guchar *p;
-    GdkPixbuf *src;
-    int w, h;
+    gboolean fits, bfits;
+
+    if (!bw)
+        return TRUE;
+    if (bw == iw && bh == ih)
+        return FALSE;
+    if (w == iw && h == ih)
+        return TRUE;
+    fits = (w >= iw && h >= ih);
+    bfits = (bw >= iw && bh >= ih);
+    if (fits != bfits)
+        return fits;
+    return fits ? (w * h < bw * bh) : (w * h > bw * bh);
+}
 
-    ENTER;
-    data = get_xaproperty(tkwin, a_NET_WM_ICON, XA_CARDINAL, &n);
-    if (!data)
-        RET(NULL);
+/* Walks sub-icons of _NET_WM_ICON reading only their headers and picks
+ * best one for iw x ih. Returns offset of its pixels, in longs, or -1 */
+static long
+netwm_icon_select(Window tkwin, int iw, int ih, int *rw, int *rh)
+{
+    gulong *data, after, total = 0, w, h;
+    long off, best = -1;
+    int i, n;
 
-    /* loop through all icons in data to find best fit */
-    if (0) {
-        gulong *tmp;
-        int len;
-
-        len = n/sizeof(gulong);
-        tmp = data;
-        while (len > 2) {
-            int size = tmp[0] * tmp[1];
-            DBG("sub-icon: %dx%d %d bytes\n", tmp[0], tmp[1], size * 4);
-            len -= size + 2;
-            tmp += size;
+    ENTER;
+    *rw = *rh = 0;
+    for (i = 0, off = 0; i < NETWM_ICON_MAX; i++) {
+        data = get_xaproperty_range(tkwin, a_NET_WM_ICON, XA_CARDINAL,
+            off, 2, &n, &after);
+        if (!data)
+            break;
+        if (n < 2) {
+            XFree(data);
+            break;
         }
+        w = data[0];
+        h = data[1];
+        XFree(data);
+        if (!i)
+            total = n + after / 4;
+        if (!w || !h || w > NETWM_ICON_SIDE || h > NETWM_ICON_SIDE
+            || off + 2 + w * h > total) {
+            ERR("win %lx: broken icon %lux%lu at %ld (size=%lu)\n", tkwin,
+                w, h, off, total);
+            break;
+        }
+        DBG("win %lx: icon %lux%lu at %ld\n", tkwin, w, h, off);
+        if (netwm_icon_better(w, h, *rw, *rh, iw, ih)) {
+            best = off + 2;
+            *rw = w;
+            *rh = h;
+            if (*rw == iw && *rh == ih)
+                break;
+        }
+        off += 2 + w * h;
+        if (off + 2 > total)
+            break;
     }
+    RET(best);
+}
 
-    if (0) {
-        int i, j, nn;
+/* Icon decoding job. Raw pixels are fetched from X on main thread, and
+ * converted and scaled in a worker thread */
+typedef struct {
+    int iw, ih;                 /* target size */
+    GdkPixbuf *ready;           /* cache hit, nothing to decode */
+    /* _NET_WM_ICON source */
+    gulong *data;
+    int w, h;
+    /* WM_HINTS source */
+    XImage *image, *mask;
+    gulong rmask, gmask, bmask;
+    /* cache key of result, if set */
+    guint64 hash;
+    char *res_class;
+} icon_job;
 
-        nn = MIN(10, n);
-        p = (guchar *) data;
-        for (i = 0; i < nn; i++) {
-            for (j = 0; j < sizeof(gulong); j++)
-                ERR("%02x ", (guint) p[i*sizeof(gulong) + j]);
-            ERR("\n");
-        }
-    }
+static void
+icon_job_free(icon_job *job)
+{
+    ENTER;
+    if (job->ready)
+        g_object_unref(job->ready);
+    if (job->data)
+        XFree(job->data);
+    g_free(job->res_class);
+    if (job->image)
+        XDestroyImage(job->image);
+    if (job->mask)
+        XDestroyImage(job->mask);
+    g_free(job);
+    RET();
+}
 
-    /* check that data indeed represents icon in w + h + ARGB[] format
-     * with 16x16 dimension at least */
-    if (n < (16 * 16 + 1 + 1)) {
-        ERR("win %lx: icon is too small or broken (size=%d)\n", tkwin, n);
-        goto out;
-    }
-    w = data[0];
-    h = data[1];
-    /* check that sizes are in 64-256 range */
-    if (w < 16 || w > 256 || h < 16 || h > 256) {
-        ERR("win %lx: icon size (%d, %d) is not in 64-256 range\n",
-            tkwin, w, h);
-        goto out;
-    }
-
-    DBG("orig  %dx%d dest %dx%d\n", w, h, iw, ih);
-    p = argbdata_to_pixdata(data + 2, w * h);
-    if (!p)
-        goto out;
-    src = gdk_pixbuf_new_from_data (p, GDK_COLORSPACE_RGB, TRUE,
-        8, w, h, w * 4, free_pixels, NULL);
-    if (src == NULL)
-        goto out;
-    ret = src;
-    if (w != iw || h != ih) {
-        ret = gdk_pixbuf_scale_simple(src, iw, ih, GDK_INTERP_HYPER);
-        g_object_unref(src);
-    }
+/* runs in worker thread */
+static void
+icon_job_run(GTask *gtask, gpointer source, gpointer data,
+    GCancellable *cancel)
+{
+    icon_job *job = data;
+    GdkPixbuf *src = NULL, *ret = NULL;
+    guchar *p;
 
-out:
-    XFree(data);
-    RET(ret);
+    ENTER;
+    if (job->data) {
+        DBG("orig  %dx%d dest %dx%d\n", job->w, job->h, job->iw, job->ih);
+        p = argbdata_to_pixdata(job->data, job->w * job->h);
+        src = gdk_pixbuf_new_from_data (p, GDK_COLORSPACE_RGB, TRUE,
+            8, job->w, job->h, job->w * 4, free_pixels, NULL);
+    } else
+        src = ximage_to_pixbuf(job->image, job->mask, job->rmask,
+            job->gmask, job->bmask);
+    if (src && !g_cancellable_is_cancelled(cancel))
+        ret = fb_pixbuf_scale(src, job->iw, job->ih);
+    if (src)
+        g_object_unref(src);
+    g_task_return_pointer(gtask, ret, g_object_unref);
+    RET();
 }
 
-static GdkPixbuf *
-get_wm_icon(Window tkwin, int iw, int ih)
+/* Prepares job for window's _NET_WM_ICON. Returns FALSE if there is
+ * no usable one */
+static gboolean
+get_netwm_icon(Window tkwin, const char *res_class, icon_job *job)
 {
-    XWMHints *hints;
-    Pixmap xpixmap = None, xmask = None;
-    Window win;
-    unsigned int w, h;
-    int sd;
-    GdkPixbuf *ret, *masked, *pixmap, *mask = NULL;
+    int n, w, h;
+    long off;
 
     ENTER;
-    hints = XGetWMHints(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tkwin);
-    DBG("\nwm_hints %s\n", hints ? "ok" : "failed");
-    if (!hints)
-        RET(NULL);
+    /* property may hold several hundred KB of icons; look at headers
+     * first and transfer pixels of chosen one only */
+    off = netwm_icon_select(tkwin, job->iw, job->ih, &w, &h);
+    if (off < 0)
+        RET(FALSE);
+    job->data = get_xaproperty_range(tkwin, a_NET_WM_ICON, XA_CARDINAL,
+        off, w * h, &n, NULL);
+    if (!job->data)
+        RET(FALSE);
+    if (n != w * h) {
+        XFree(job->data);
+        job->data = NULL;
+        RET(FALSE);
+    }
+    /* other windows of this app likely have the same icon */
+    job->hash = fb_icon_hash(job->data, w, h);
+    job->ready = fb_icon_cache_get(res_class, job->hash, job->iw, job->ih);
+    if (job->ready) {
+        XFree(job->data);
+        job->data = NULL;
+        RET(TRUE);
+    }
+    job->w = w;
+    job->h = h;
+    job->res_class = g_strdup(res_class);
+    RET(TRUE);
+}
+
+/* Prepares job for window's WM_HINTS icon pixmap, which registry keeps
+ * up to date. Returns FALSE if there is no usable one. Pixmap contents
+ * may have changed under the same id when hints are set again, so
+ * cached copy is only reused if asked to */
+static gboolean
+get_wm_icon(fb_client *c, gboolean reuse, icon_job *job)
+{
+    Display *dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+    const char *res_class = c->ch.res_class;
+    XVisualInfo vi;
+    Visual *visual;
+    Pixmap xpixmap = c->icon_pixmap, xmask = c->icon_mask;
+    unsigned int w, h, depth, mw, mh, md;
 
-    if ((hints->flags & IconPixmapHint))
-        xpixmap = hints->icon_pixmap;
-    if ((hints->flags & IconMaskHint))
-        xmask = hints->icon_mask;
-    DBG("flag=%ld xpixmap=%lx flag=%ld xmask=%lx\n",
-        (hints->flags & IconPixmapHint), xpixmap,
-        (hints->flags & IconMaskHint),  xmask);
-    XFree(hints);
+    ENTER;
+    DBG("xpixmap=%lx xmask=%lx\n", xpixmap, xmask);
     if (xpixmap == None)
-        RET(NULL);
+        RET(FALSE);
 
-    if (!XGetGeometry (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), xpixmap, &win, &sd, &sd, &w, &h,
-              (guint *)&sd, (guint *)&sd)) {
-        DBG("XGetGeometry failed for %x pixmap\n", (unsigned int)xpixmap);
-        RET(NULL);
+    /* legacy apps share one icon pixmap among all their windows */
+    job->hash = fb_icon_hash_xid(xpixmap, xmask);
+    if (reuse) {
+        job->ready = fb_icon_cache_get(res_class, job->hash, job->iw,
+            job->ih);
+        if (job->ready)
+            RET(TRUE);
     }
-    DBG("tkwin=%x icon pixmap w=%d h=%d\n", tkwin, w, h);
-    pixmap = _wnck_gdk_pixbuf_get_from_pixmap (NULL, xpixmap, 0, 0, 0, 0, w, h);
-    if (!pixmap)
-        RET(NULL);
-    if (xmask != None && XGetGeometry (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), xmask,
-              &win, &sd, &sd, &w, &h, (guint *)&sd, (guint *)&sd)) {
-        mask = _wnck_gdk_pixbuf_get_from_pixmap (NULL, xmask, 0, 0, 0, 0, w, h);
-
-        if (mask) {
-            masked = apply_mask (pixmap, mask);
-            g_object_unref (G_OBJECT (pixmap));
-            g_object_unref (G_OBJECT (mask));
-            pixmap = masked;
+    job->image = get_pixmap_image(xpixmap, &w, &h, &depth);
+    if (!job->image)
+        RET(FALSE);
+    DBG("win=%lx icon pixmap w=%d h=%d depth=%d\n", c->win, w, h, depth);
+    if (depth == (unsigned int) DefaultDepth(dpy, DefaultScreen(dpy))) {
+        visual = DefaultVisual(dpy, DefaultScreen(dpy));
+        job->rmask = visual->red_mask;
+        job->gmask = visual->green_mask;
+        job->bmask = visual->blue_mask;
+    } else if (depth != 1) {
+        if (!XMatchVisualInfo(dpy, DefaultScreen(dpy), depth, TrueColor,
+                &vi)) {
+            DBG("no TrueColor visual of depth %d\n", depth);
+            XDestroyImage(job->image);
+            job->image = NULL;
+            RET(FALSE);
         }
+        job->rmask = vi.red_mask;
+        job->gmask = vi.green_mask;
+        job->bmask = vi.blue_mask;
     }
-    if (!pixmap)
-        RET(NULL);
-    ret = gdk_pixbuf_scale_simple (pixmap, iw, ih, GDK_INTERP_TILES);
-    g_object_unref(pixmap);
-
-    RET(ret);
+    if (xmask != None) {
+        job->mask = get_pixmap_image(xmask, &mw, &mh, &md);
+        if (job->mask && md != 1) {
+            XDestroyImage(job->mask);
+            job->mask = NULL;
+        }
+    }
+    job->res_class = g_strdup(res_class);
+    RET(TRUE);
 }
 
 inline static GdkPixbuf*
@@ -585,65 +778,145 @@ get_generic_icon(taskbar_priv *tb)
     RET(tb->gen_pixbuf);
 }
 
+/* takes over pixbuf reference */
 static void
-tk_update_icon (taskbar_priv *tb, task *tk, Atom a)
+tk_set_icon(task *tk, GdkPixbuf *pixbuf)
 {
+    ENTER;
+    if (tk->pixbuf)
+        g_object_unref(tk->pixbuf);
+    tk->pixbuf = pixbuf;
+    if (tk->image)
+        gtk_image_set_from_pixbuf(GTK_IMAGE(tk->image), pixbuf);
+    else if (tk->group && tk->group->icon_tk == tk && tk->group->image)
+        gtk_image_set_from_pixbuf(GTK_IMAGE(tk->group->image), pixbuf);
+    DBG("%lx: %dx%d\n", tk->win, gdk_pixbuf_get_width(pixbuf),
+        gdk_pixbuf_get_height(pixbuf));
+    RET();
+}
+
+static void
+tk_icon_job_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+    task *tk = data;
+    icon_job *job;
     GdkPixbuf *pixbuf;
+    GError *err = NULL;
+
+    ENTER;
+    pixbuf = g_task_propagate_pointer(G_TASK(res), &err);
+    if (err) {
+        /* cancelled, task may be gone already */
+        g_error_free(err);
+        RET();
+    }
+    g_clear_object(&tk->icon_cancel);
+    job = g_task_get_task_data(G_TASK(res));
+    if (!pixbuf)
+        pixbuf = get_generic_icon(tk->tb);
+    else if (job->hash)
+        fb_icon_cache_put(job->res_class, job->hash, job->iw, job->ih,
+            pixbuf);
+    tk_set_icon(tk, pixbuf);
+    RET();
+}
+
+static void
+tk_cancel_icon(task *tk)
+{
+    ENTER;
+    if (tk->icon_cancel) {
+        g_cancellable_cancel(tk->icon_cancel);
+        g_clear_object(&tk->icon_cancel);
+    }
+    RET();
+}
+
+/* Fetches window icon and starts decoding it. Until it is done, task
+ * keeps its current icon, or shows generic one if it has none yet */
+static void
+tk_update_icon (taskbar_priv *tb, task *tk, Atom a)
+{
+    icon_job *job;
+    GTask *gtask;
 
     ENTER;
     DBG("%lx: ", tk->win);
-    pixbuf = tk->pixbuf;
+    /* WM_HINTS change does not matter while _NET_WM_ICON is used */
+    if (a != a_NET_WM_ICON && a != None && tk->using_netwm_icon)
+        RET();
+    /* newer icon makes pending one stale */
+    tk_cancel_icon(tk);
+    job = g_new0(icon_job, 1);
+    job->iw = job->ih = tb->iconsize;
     if (a == a_NET_WM_ICON || a == None) {
-        tk->pixbuf = get_netwm_icon(tk->win, tb->iconsize, tb->iconsize);
-        tk->using_netwm_icon = (tk->pixbuf != NULL);
+        tk->using_netwm_icon = get_netwm_icon(tk->win, tk->c->ch.res_class,
+            job);
         DBGE("netwm_icon=%d ", tk->using_netwm_icon);
     }
     if (!tk->using_netwm_icon) {
-        tk->pixbuf = get_wm_icon(tk->win, tb->iconsize, tb->iconsize);
-        DBGE("wm_icon=%d ", (tk->pixbuf != NULL));
+        get_wm_icon(tk->c, a == None, job);
+        DBGE("wm_icon=%d ", (job->image != NULL));
     }
-    if (!tk->pixbuf) {
-        tk->pixbuf = get_generic_icon(tb); // always exists
-        DBGE("generic_icon=1");
-    }
-    if (pixbuf != tk->pixbuf) {
-        if (pixbuf)
-            g_object_unref(pixbuf);
+    if (job->ready || !(job->data || job->image)) {
+        tk_set_icon(tk, job->ready ? g_object_ref(job->ready)
+            : get_generic_icon(tb));
+        icon_job_free(job);
+        RET();
     }
-    DBGE(" %dx%d \n", gdk_pixbuf_get_width(tk->pixbuf),
-        gdk_pixbuf_get_height(tk->pixbuf));
+    if (!tk->pixbuf)
+        tk_set_icon(tk, get_generic_icon(tb));
+    tk->icon_cancel = g_cancellable_new();
+    gtask = g_task_new(NULL, tk->icon_cancel, tk_icon_job_done, tk);
+    g_task_set_task_data(gtask, job, (GDestroyNotify) icon_job_free);
+    g_task_run_in_thread(gtask, icon_job_run);
+    g_object_unref(gtask);
     RET();
 }
 
-static gboolean
-on_flash_win( task *tk )
+static void
+on_flash_win(gboolean on, task *tk)
 {
-    tk->flash_state = !tk->flash_state;
+    tk->flash_state = on;
     gtk_widget_set_state_flags(tk->button, tk->flash_state ? GTK_STATE_SELECTED : tk->tb->normal_state, TRUE);
     gtk_widget_queue_draw(tk->button);
-    return TRUE;
 }
 
+/* blinks in step with other urgent items, see blink.h; task without
+ * button starts once it gets one */
 static void
 tk_flash_window( task *tk )
 {
-    gint interval;
-    tk->flash = 1;
-    tk->flash_state = !tk->flash_state;
-    if (tk->flash_timeout)
+    if (tk->group) {
+        if (!tk->flash) {
+            tk->flash = 1;
+            grp_flash(tk->group, 1);
+        }
         return;
-    g_object_get( gtk_widget_get_settings(tk->button),
-          "gtk-cursor-blink-time", &interval, NULL );
-    tk->flash_timeout = g_timeout_add(interval, (GSourceFunc)on_flash_win, tk);
+    }
+    tk->flash = 1;
+    if (tk->button)
+        fb_blink_add((fb_blink_func) on_flash_win, tk);
 }
 
 static void
 tk_unflash_window( task *tk )
 {
+    int flash = tk->flash;
+
+    if (tk->group) {
+        if (tk->flash) {
+            tk->flash = 0;
+            grp_flash(tk->group, -1);
+        }
+        return;
+    }
     tk->flash = tk->flash_state = 0;
-    if (tk->flash_timeout) {
-        g_source_remove(tk->flash_timeout);
-        tk->flash_timeout = 0;
+    fb_blink_remove((fb_blink_func) on_flash_win, tk);
+    if (flash) {
+        /* blinking left its own state on button */
+        tk->shown = 0;
+        tk_display(tk->tb, tk);
     }
 }
 
@@ -667,6 +940,25 @@ tk_raise_window( task *tk, guint32 time )
     DBG("XRaiseWindow %x\n", tk->win);
 }
 
+/* maps iconified window back */
+static void
+tk_show_window(task *tk, guint32 time)
+{
+    if(use_net_active) {
+        Xclimsg(tk->win, a_NET_ACTIVE_WINDOW, 2, time, 0, 0, 0);
+    } else {
+        GdkWindow *gdkwindow;
+
+        gdkwindow =  gdk_x11_window_lookup_for_display(gdk_display_get_default(), tk->win);
+        if (gdkwindow)
+            gdk_window_show (gdkwindow);
+        else
+            XMapRaised (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win);
+        XSync (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), False);
+        DBG("XMapRaised  %x\n", tk->win);
+    }
+}
+
 static void
 tk_callback_leave( GtkWidget *widget, task *tk)
 {
@@ -816,20 +1108,7 @@ tk_callback_button_release_event(GtkWidget *widget, GdkEventButton *event,
     DBG("win=%x\n", tk->win);
     if (event->button == 1) {
         if (tk->iconified)    {
-            if(use_net_active) {
-                Xclimsg(tk->win, a_NET_ACTIVE_WINDOW, 2, event->time, 0, 0, 0);
-            } else {
-                GdkWindow *gdkwindow;
-
-                //gdkwindow = gdk_xid_table_lookup (tk->win);
-        	gdkwindow =  gdk_x11_window_lookup_for_display(gdk_display_get_default(), tk->win);
-                if (gdkwindow)
-                    gdk_window_show (gdkwindow);
-                else
-                    XMapRaised (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win);
-                XSync (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), False);
-                DBG("XMapRaised  %x\n", tk->win);
-            }
+            tk_show_window(tk, event->time);
         } else {
             DBG("tb->ptk = %x\n", (tk->tb->ptk) ? tk->tb->ptk->win : 0);
             if (tk->focused || tk == tk->tb->ptk) {
@@ -867,7 +1146,15 @@ tk_update(gpointer key, task *tk, taskbar_priv *tb)
 {
     ENTER;
     g_assert ((tb != NULL) && (tk != NULL));
+    if (tk->group) {
+        grp_task_update(tb, tk, task_visible(tb, tk));
+        RET();
+    }
     if (task_visible(tb, tk)) {
+        if (!tk->button)
+            tk_build_gui(tb, tk);
+        if (tk->shown && tk->shown_focused == tk->focused)
+            RET();
         gtk_widget_set_state_flags (tk->button, (tk->focused) ? tb->focused_state : tb->normal_state, TRUE);
         gtk_widget_queue_draw(tk->button);
         //_gtk_button_set_depressed(GTK_BUTTON(tk->button), tk->focused);
@@ -876,9 +1163,13 @@ tk_update(gpointer key, task *tk, taskbar_priv *tb)
         if (tb->tooltips) {
             gtk_widget_set_tooltip_text(tk->button, tk->name);
         }
+        tk->shown = 1;
+        tk->shown_focused = tk->focused;
         RET();
     }
-    gtk_widget_hide(tk->button);
+    if (tk->button && tk->shown)
+        gtk_widget_hide(tk->button);
+    tk->shown = 0;
     RET();
 }
 
@@ -894,37 +1185,147 @@ static void
 tb_display(taskbar_priv *tb)
 {
     ENTER;
-    if (tb->wins)
-        g_hash_table_foreach(tb->task_list, (GHFunc) tk_update, (gpointer) tb);
+    g_hash_table_foreach(tb->task_list, (GHFunc) tk_update, (gpointer) tb);
     RET();
 
 }
 
+/* updates tasks of one desktop only */
 static void
-tk_build_gui(taskbar_priv *tb, task *tk)
+tb_display_desk(taskbar_priv *tb, guint desk)
 {
-    GtkWidget *w1;
+    GList *l;
 
     ENTER;
-    g_assert ((tb != NULL) && (tk != NULL));
+    l = g_hash_table_lookup(tb->desk_tasks, GUINT_TO_POINTER(desk));
+    for (; l; l = l->next)
+        tk_update(NULL, l->data, tb);
+    RET();
+}
 
-    /* NOTE
-     * 1. the extended mask is sum of taskbar and pager needs
-     * see bug [ 940441 ] pager loose track of windows
-     *
-     * Do not change event mask to gtk windows spwaned by this gtk client
-     * this breaks gtk internals */
-    if (!FBPANEL_WIN(tk->win))
-        XSelectInput(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win,
-                PropertyChangeMask | StructureNotifyMask);
+/* creates hidden task button with its children. In grouping mode, icon
+ * gets an overlay for member count */
+static GtkWidget *
+tb_new_button(taskbar_priv *tb)
+{
+    GtkWidget *button, *image, *label, *badge, *pix, *w1;
 
+    ENTER;
     /* button */
-    tk->button = gtk_button_new();
-    //gtk_button_set_alignment(GTK_BUTTON(tk->button), 0.5, 0.5);
-    gtk_widget_show(tk->button);
-    gtk_container_set_border_width(GTK_CONTAINER(tk->button), 0);
-    gtk_widget_add_events (tk->button, GDK_BUTTON_RELEASE_MASK
+    button = gtk_button_new();
+    //gtk_button_set_alignment(GTK_BUTTON(button), 0.5, 0.5);
+    gtk_container_set_border_width(GTK_CONTAINER(button), 0);
+    gtk_widget_add_events (button, GDK_BUTTON_RELEASE_MASK
             | GDK_BUTTON_PRESS_MASK);
+    gtk_drag_dest_set( button, 0, NULL, 0, 0);
+
+    /* pix */
+    pix = image = gtk_image_new();
+    //gtk_misc_set_alignment(GTK_MISC(image), 0.5, 0.5);
+    gtk_widget_set_halign(image, GTK_ALIGN_CENTER);
+    gtk_widget_set_valign(image, GTK_ALIGN_CENTER);
+    //gtk_misc_set_padding(GTK_MISC(image), 0, 0);
+    gtk_widget_set_margin_start(image, 0);
+    gtk_widget_set_margin_end(image, 0);
+    gtk_widget_set_margin_top(image, 0);
+    gtk_widget_set_margin_bottom(image, 0);
+
+    badge = NULL;
+    if (tb->group_by_class) {
+        pix = gtk_overlay_new();
+        gtk_container_add(GTK_CONTAINER(pix), image);
+        badge = gtk_label_new(NULL);
+        gtk_widget_set_halign(badge, GTK_ALIGN_END);
+        gtk_widget_set_valign(badge, GTK_ALIGN_END);
+        gtk_widget_set_no_show_all(badge, TRUE);
+        gtk_overlay_add_overlay(GTK_OVERLAY(pix), badge);
+    }
+    w1 = pix;
+
+    label = NULL;
+    if (!tb->icons_only) {
+        w1 = gtk_box_new(FALSE, 1);
+        gtk_container_set_border_width(GTK_CONTAINER(w1), 0);
+        gtk_box_pack_start(GTK_BOX(w1), pix, FALSE, FALSE, 0);
+        label = gtk_label_new(NULL);
+        gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+        //gtk_misc_set_alignment(GTK_MISC(label), 0.0, 0.5);
+	gtk_widget_set_halign(label, GTK_ALIGN_START);
+	gtk_widget_set_valign(label, GTK_ALIGN_CENTER);
+        //gtk_misc_set_padding(GTK_MISC(label), 0, 0);
+	gtk_widget_set_margin_start(label, 0);
+	gtk_widget_set_margin_end(label, 0);
+	gtk_widget_set_margin_top(label, 0);
+	gtk_widget_set_margin_bottom(label, 0);
+        gtk_box_pack_start(GTK_BOX(w1), label, TRUE, TRUE, 0);
+    }
+
+    gtk_container_add (GTK_CONTAINER (button), w1);
+    gtk_box_pack_start(GTK_BOX(tb->bar), button, FALSE, TRUE, 0);
+    //GTK_WIDGET_UNSET_FLAGS (button, GTK_CAN_FOCUS);
+    gtk_widget_set_can_focus(button,FALSE);
+    //GTK_WIDGET_UNSET_FLAGS (button, GTK_CAN_DEFAULT);
+    gtk_widget_set_can_default(button, TRUE);
+    gtk_widget_show_all(w1);
+    g_object_set_data(G_OBJECT(button), "taskbar-image", image);
+    g_object_set_data(G_OBJECT(button), "taskbar-label", label);
+    g_object_set_data(G_OBJECT(button), "taskbar-badge", badge);
+    RET(button);
+}
+
+/* Returns hidden button, recycled or new. Windows often come and go in
+ * bursts, so few unused buttons are kept hidden in the bar for reuse */
+static GtkWidget *
+tb_get_button(taskbar_priv *tb)
+{
+    GtkWidget *button;
+
+    ENTER;
+    if (!tb->pool)
+        RET(tb_new_button(tb));
+    button = tb->pool->data;
+    tb->pool = g_slist_delete_link(tb->pool, tb->pool);
+    tb->pool_len--;
+    /* new buttons go to the end */
+    gtk_box_reorder_child(GTK_BOX(tb->bar), button, -1);
+    RET(button);
+}
+
+/* takes back button whose signal handlers are disconnected */
+static void
+tb_put_button(taskbar_priv *tb, GtkWidget *button)
+{
+    GtkWidget *badge;
+
+    ENTER;
+    if (tb->pool_len >= TASK_POOL_MAX) {
+        gtk_widget_destroy(button);
+        RET();
+    }
+    gtk_widget_hide(button);
+    gtk_widget_set_state_flags(button, tb->normal_state, TRUE);
+    gtk_widget_set_tooltip_text(button, NULL);
+    /* drop pixbuf reference, so icon cache can let it go */
+    gtk_image_clear(GTK_IMAGE(g_object_get_data(G_OBJECT(button),
+                "taskbar-image")));
+    if ((badge = g_object_get_data(G_OBJECT(button), "taskbar-badge")))
+        gtk_widget_hide(badge);
+    tb->pool = g_slist_prepend(tb->pool, button);
+    tb->pool_len++;
+    RET();
+}
+
+/* Gives task a button, new or recycled. It is done when task is to be
+ * shown first time, so tasks of other desktops cost no widgets */
+static void
+tk_build_gui(taskbar_priv *tb, task *tk)
+{
+    ENTER;
+    g_assert ((tb != NULL) && (tk != NULL));
+
+    tk->button = tb_get_button(tb);
+    tk->image = g_object_get_data(G_OBJECT(tk->button), "taskbar-image");
+    tk->label = g_object_get_data(G_OBJECT(tk->button), "taskbar-label");
     g_signal_connect(G_OBJECT(tk->button), "button_release_event",
           G_CALLBACK(tk_callback_button_release_event), (gpointer)tk);
     g_signal_connect(G_OBJECT(tk->button), "button_press_event",
@@ -933,7 +1334,6 @@ tk_build_gui(taskbar_priv *tb, task *tk)
           G_CALLBACK (tk_callback_leave), (gpointer) tk);
     g_signal_connect_after (G_OBJECT (tk->button), "enter",
           G_CALLBACK (tk_callback_enter), (gpointer) tk);
-    gtk_drag_dest_set( tk->button, 0, NULL, 0, 0);
     g_signal_connect (G_OBJECT (tk->button), "drag-motion",
           G_CALLBACK (tk_callback_drag_motion), (gpointer) tk);
     g_signal_connect (G_OBJECT (tk->button), "drag-leave",
@@ -942,48 +1342,8 @@ tk_build_gui(taskbar_priv *tb, task *tk)
         g_signal_connect_after(G_OBJECT(tk->button), "scroll-event",
               G_CALLBACK(tk_callback_scroll_event), (gpointer)tk);
 
-    /* pix */
     tk_update_icon(tb, tk, None);
-    w1 = tk->image = gtk_image_new_from_pixbuf(tk->pixbuf);
-    //gtk_misc_set_alignment(GTK_MISC(tk->image), 0.5, 0.5);
-    gtk_widget_set_halign(tk->image, GTK_ALIGN_CENTER);
-    gtk_widget_set_valign(tk->image, GTK_ALIGN_CENTER);
-    //gtk_misc_set_padding(GTK_MISC(tk->image), 0, 0);
-    gtk_widget_set_margin_start(tk->image, 0);
-    gtk_widget_set_margin_end(tk->image, 0);
-    gtk_widget_set_margin_top(tk->image, 0);
-    gtk_widget_set_margin_bottom(tk->image, 0);
-
-    if (!tb->icons_only) {
-        w1 = gtk_box_new(FALSE, 1);
-        gtk_container_set_border_width(GTK_CONTAINER(w1), 0);
-        gtk_box_pack_start(GTK_BOX(w1), tk->image, FALSE, FALSE, 0);
-        tk->label = gtk_label_new(tk->iconified ? tk->iname : tk->name);
-        gtk_label_set_ellipsize(GTK_LABEL(tk->label), PANGO_ELLIPSIZE_END);
-        //gtk_misc_set_alignment(GTK_MISC(tk->label), 0.0, 0.5);
-	gtk_widget_set_halign(tk->label, GTK_ALIGN_START);
-	gtk_widget_set_valign(tk->label, GTK_ALIGN_CENTER);
-        //gtk_misc_set_padding(GTK_MISC(tk->label), 0, 0);
-	gtk_widget_set_margin_start(tk->label, 0);
-	gtk_widget_set_margin_end(tk->label, 0);
-	gtk_widget_set_margin_top(tk->label, 0);
-	gtk_widget_set_margin_bottom(tk->label, 0);
-        gtk_box_pack_start(GTK_BOX(w1), tk->label, TRUE, TRUE, 0);
-    }
-
-    gtk_container_add (GTK_CONTAINER (tk->button), w1);
-    gtk_box_pack_start(GTK_BOX(tb->bar), tk->button, FALSE, TRUE, 0);
-    //GTK_WIDGET_UNSET_FLAGS (tk->button, GTK_CAN_FOCUS);
-    gtk_widget_set_can_focus(tk->button,FALSE);
-    //GTK_WIDGET_UNSET_FLAGS (tk->button, GTK_CAN_DEFAULT);
-    gtk_widget_set_can_default(tk->button, TRUE);
-
-    
-    gtk_widget_show_all(tk->button);
-    if (!task_visible(tb, tk)) {
-        gtk_widget_hide(tk->button);
-    }
-
+    tk_set_names(tk);
     if (tk->urgency) {
         /* Flash button for window with urgency hint */
         tk_flash_window(tk);
@@ -991,86 +1351,484 @@ tk_build_gui(taskbar_priv *tb, task *tk)
     RET();
 }
 
-static gboolean
-task_remove_every(Window *win, task *tk)
+/* takes button away from task that is going away */
+static void
+tk_release_gui(taskbar_priv *tb, task *tk)
 {
     ENTER;
-    del_task(tk->tb, tk, 0);
-    RET(TRUE);
+    if (!tk->button)
+        RET();
+    g_signal_handlers_disconnect_by_data(tk->button, tk);
+    fb_blink_remove((fb_blink_func) on_flash_win, tk);
+    tk->flash_state = 0;
+    tb_put_button(tb, tk->button);
+    tk->button = tk->image = tk->label = NULL;
+    tk->shown = 0;
+    RET();
+}
+
+/*****************************************************
+ * tasks grouped by application class                *
+ *****************************************************/
+
+/* first member that passes task_visible */
+static task *
+grp_shown_task(tgroup *g)
+{
+    GList *l;
+
+    for (l = g->tasks; l; l = l->next)
+        if (((task *) l->data)->shown)
+            return l->data;
+    return NULL;
+}
+
+static void
+grp_set_names(tgroup *g)
+{
+    task *tk = NULL;
+    char *name, *tip, *buf;
+
+    ENTER;
+    if (!g->button)
+        RET();
+    if (g->nshown == 1)
+        tk = grp_shown_task(g);
+    if (tk) {
+        name = tk->iconified ? tk->iname : tk->name;
+        tip = tk->name;
+    } else
+        name = tip = g->name;
+    if (g->label)
+        gtk_label_set_text(GTK_LABEL(g->label), name);
+    if (g->tb->tooltips)
+        gtk_widget_set_tooltip_text(g->button, tip);
+    if (g->nshown > 1) {
+        buf = g_strdup_printf("<small><b>%d</b></small>", g->nshown);
+        gtk_label_set_markup(GTK_LABEL(g->badge), buf);
+        g_free(buf);
+        gtk_widget_show(g->badge);
+    } else
+        gtk_widget_hide(g->badge);
+    RET();
+}
+
+static void
+grp_blink(gboolean on, tgroup *g)
+{
+    g->flash_state = on;
+    gtk_widget_set_state_flags(g->button, on ? GTK_STATE_SELECTED
+        : g->tb->normal_state, TRUE);
+    gtk_widget_queue_draw(g->button);
+}
+
+/* group blinks while any of its members wants attention */
+static void
+grp_flash(tgroup *g, int delta)
+{
+    ENTER;
+    g->nflash += delta;
+    if (!g->button)
+        RET();
+    if (g->nflash == 1 && delta > 0)
+        fb_blink_add((fb_blink_func) grp_blink, g);
+    else if (!g->nflash) {
+        fb_blink_remove((fb_blink_func) grp_blink, g);
+        g->flash_state = 0;
+        gtk_widget_set_state_flags(g->button, g->shown_focused
+            ? g->tb->focused_state : g->tb->normal_state, TRUE);
+        gtk_widget_queue_draw(g->button);
+    }
+    RET();
+}
+
+static void
+grp_callback_enter_leave(GtkWidget *widget, tgroup *g)
+{
+    ENTER;
+    gtk_widget_set_state_flags(widget, g->shown_focused
+        ? g->tb->focused_state : g->tb->normal_state, TRUE);
+    RET();
 }
 
-/* tell to remove element with zero refcount */
 static gboolean
-task_remove_stale(Window *win, task *tk, gpointer data)
+grp_callback_button_press_event(GtkWidget *widget, GdkEventButton *event,
+    tgroup *g)
 {
     ENTER;
-    if (tk->refcount-- == 0) {
-        //DBG("tb_net_list <del>: 0x%x %s\n", tk->win, tk->name);
-        del_task(tk->tb, tk, 0);
+    if (event->type == GDK_BUTTON_PRESS && event->button == 3
+          && event->state & GDK_CONTROL_MASK) {
+        g->tb->discard_release_event = 1;
+        gtk_propagate_event(g->tb->bar, (GdkEvent *)event);
         RET(TRUE);
     }
     RET(FALSE);
 }
 
+static void
+grp_menu_activate(GtkWidget *mi, taskbar_priv *tb)
+{
+    task *tk;
+
+    ENTER;
+    /* window may be gone while menu was up */
+    tk = find_task(tb, (Window) GPOINTER_TO_SIZE(g_object_get_data(
+                G_OBJECT(mi), "taskbar-win")));
+    if (!tk)
+        RET();
+    if (tk->iconified)
+        tk_show_window(tk, gtk_get_current_event_time());
+    else
+        tk_raise_window(tk, gtk_get_current_event_time());
+    RET();
+}
+
+/* pops up list of group members shown on this desktop */
+static void
+grp_popup(taskbar_priv *tb, tgroup *g)
+{
+    GtkWidget *menu, *mi;
+    GList *l;
+    task *tk;
+
+    ENTER;
+    menu = gtk_menu_new();
+    for (l = g->tasks; l; l = l->next) {
+        tk = l->data;
+        if (!tk->shown)
+            continue;
+        mi = gtk_menu_item_new_with_label(tk->name ? (tk->iconified
+                ? tk->iname : tk->name) : g->name);
+        g_object_set_data(G_OBJECT(mi), "taskbar-win",
+            GSIZE_TO_POINTER(tk->win));
+        g_signal_connect(G_OBJECT(mi), "activate",
+            (GCallback) grp_menu_activate, tb);
+        /* members are kept newest first */
+        gtk_menu_shell_prepend(GTK_MENU_SHELL(menu), mi);
+    }
+    gtk_widget_show_all(menu);
+    if (tb->group_menu)
+        gtk_widget_destroy(tb->group_menu);
+    tb->group_menu = menu;
+    gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+    RET();
+}
+
+/* Lone member is handled as if it had its own button, otherwise
+ * members are listed to pick from */
+static gboolean
+grp_callback_button_release_event(GtkWidget *widget, GdkEventButton *event,
+    tgroup *g)
+{
+    task *tk;
+
+    ENTER;
+    if (event->type != GDK_BUTTON_RELEASE)
+        RET(FALSE);
+    if (g->nshown == 1 && (tk = grp_shown_task(g)))
+        RET(tk_callback_button_release_event(widget, event, tk));
+    if (g->tb->discard_release_event) {
+        g->tb->discard_release_event = 0;
+        RET(TRUE);
+    }
+    if (event->button == 1 || event->button == 3)
+        grp_popup(g->tb, g);
+    RET(TRUE);
+}
+
+static void
+grp_build_gui(taskbar_priv *tb, tgroup *g)
+{
+    ENTER;
+    g->button = tb_get_button(tb);
+    g->image = g_object_get_data(G_OBJECT(g->button), "taskbar-image");
+    g->label = g_object_get_data(G_OBJECT(g->button), "taskbar-label");
+    g->badge = g_object_get_data(G_OBJECT(g->button), "taskbar-badge");
+    g_signal_connect(G_OBJECT(g->button), "button_release_event",
+          G_CALLBACK(grp_callback_button_release_event), (gpointer)g);
+    g_signal_connect(G_OBJECT(g->button), "button_press_event",
+           G_CALLBACK(grp_callback_button_press_event), (gpointer)g);
+    g_signal_connect_after (G_OBJECT (g->button), "leave",
+          G_CALLBACK (grp_callback_enter_leave), (gpointer) g);
+    g_signal_connect_after (G_OBJECT (g->button), "enter",
+          G_CALLBACK (grp_callback_enter_leave), (gpointer) g);
+    g->shown_count = 0;
+    if (g->icon_tk->pixbuf)
+        gtk_image_set_from_pixbuf(GTK_IMAGE(g->image), g->icon_tk->pixbuf);
+    else
+        tk_update_icon(tb, g->icon_tk, None);
+    if (g->nflash)
+        fb_blink_add((fb_blink_func) grp_blink, g);
+    RET();
+}
+
+static void
+grp_release_gui(taskbar_priv *tb, tgroup *g)
+{
+    ENTER;
+    if (!g->button)
+        RET();
+    g_signal_handlers_disconnect_by_data(g->button, g);
+    fb_blink_remove((fb_blink_func) grp_blink, g);
+    g->flash_state = 0;
+    tb_put_button(tb, g->button);
+    g->button = g->image = g->label = g->badge = NULL;
+    g->shown_count = 0;
+    RET();
+}
+
+/* Brings group button up to date. Group gets button when it first has
+ * something to show, and keeps it until last member is gone */
+static void
+grp_display(taskbar_priv *tb, tgroup *g)
+{
+    int focused;
+
+    ENTER;
+    if (!g->nshown) {
+        if (g->button && g->shown_count)
+            gtk_widget_hide(g->button);
+        g->shown_count = 0;
+        RET();
+    }
+    if (!g->button)
+        grp_build_gui(tb, g);
+    focused = (tb->focused && tb->focused->group == g);
+    if (g->shown_count == g->nshown && g->shown_focused == focused)
+        RET();
+    if (g->shown_count != g->nshown) {
+        if (!g->shown_count)
+            gtk_widget_show(g->button);
+        g->shown_count = g->nshown;
+        grp_set_names(g);
+    }
+    g->shown_focused = focused;
+    if (!g->flash_state) {
+        gtk_widget_set_state_flags(g->button, focused ? tb->focused_state
+            : tb->normal_state, TRUE);
+        gtk_widget_queue_draw(g->button);
+    }
+    RET();
+}
+
+/* member's visibility or focus may have changed */
+static void
+grp_task_update(taskbar_priv *tb, task *tk, gboolean visible)
+{
+    tgroup *g = tk->group;
+
+    ENTER;
+    if (visible != tk->shown) {
+        tk->shown = visible;
+        g->nshown += visible ? 1 : -1;
+    }
+    grp_display(tb, g);
+    RET();
+}
+
+static void
+grp_free(tgroup *g)
+{
+    ENTER;
+    g_free(g->res_class);
+    g_free(g->name);
+    g_free(g);
+    RET();
+}
+
+static void
+grp_add(taskbar_priv *tb, task *tk)
+{
+    const char *res_class;
+    tgroup *g;
+
+    ENTER;
+    res_class = tk->c->ch.res_class ? tk->c->ch.res_class : "";
+    if (!(g = g_hash_table_lookup(tb->groups, res_class))) {
+        g = g_new0(tgroup, 1);
+        g->tb = tb;
+        g->res_class = g_strdup(res_class);
+        g->name = g_strdup_printf(" %s ", res_class);
+        g_hash_table_insert(tb->groups, g->res_class, g);
+    }
+    g->tasks = g_list_prepend(g->tasks, tk);
+    tk->group = g;
+    if (!g->icon_tk)
+        g->icon_tk = tk;
+    RET();
+}
+
+/* Takes task out of its group; group goes away with last member. Cost
+ * does not depend on group size, except for finding new icon owner */
+static void
+grp_remove(taskbar_priv *tb, task *tk)
+{
+    tgroup *g = tk->group;
+    GList *l;
+
+    ENTER;
+    if (!g)
+        RET();
+    if (tk->flash)
+        grp_flash(g, -1);
+    if (tk->shown)
+        grp_task_update(tb, tk, FALSE);
+    tk->flash = 0;
+    g->tasks = g_list_remove(g->tasks, tk);
+    tk->group = NULL;
+    if (!g->tasks) {
+        grp_release_gui(tb, g);
+        g_hash_table_remove(tb->groups, g->res_class);
+        RET();
+    }
+    if (g->icon_tk == tk) {
+        /* prefer member that has its icon already */
+        g->icon_tk = g->tasks->data;
+        for (l = g->tasks; l; l = l->next)
+            if (((task *) l->data)->pixbuf) {
+                g->icon_tk = l->data;
+                break;
+            }
+        if (g->button && g->icon_tk->pixbuf)
+            gtk_image_set_from_pixbuf(GTK_IMAGE(g->image),
+                g->icon_tk->pixbuf);
+        else if (g->button)
+            tk_update_icon(tb, g->icon_tk, None);
+    }
+    RET();
+}
+
+static gboolean
+task_remove_every(Window *win, task *tk)
+{
+    ENTER;
+    del_task(tk->tb, tk, 0);
+    RET(TRUE);
+}
+
 /*****************************************************
  * handlers for NET actions                          *
  *****************************************************/
 
-
 static void
-tb_net_client_list(GtkWidget *widget, taskbar_priv *tb)
+tb_add_task(fb_client *c, taskbar_priv *tb)
 {
-    int i;
     task *tk;
 
     ENTER;
-    if (tb->wins)
-        XFree(tb->wins);
-    tb->wins = get_xaproperty (GDK_ROOT_WINDOW(),
-        a_NET_CLIENT_LIST, XA_WINDOW, &tb->win_num);
-    if (!tb->wins)
+    if (find_task(tb, c->win))
+        RET();
+    if (!accept_net_wm_state(&c->nws, tb->accept_skip_pager)
+            || !accept_net_wm_window_type(&c->nwwt))
         RET();
-    for (i = 0; i < tb->win_num; i++) {
-        if ((tk = g_hash_table_lookup(tb->task_list, &tb->wins[i]))) {
-            tk->refcount++;
-        } else {
-            net_wm_window_type nwwt;
-            net_wm_state nws;
-
-            get_net_wm_state(tb->wins[i], &nws);
-            if (!accept_net_wm_state(&nws, tb->accept_skip_pager))
-                continue;
-            get_net_wm_window_type(tb->wins[i], &nwwt);
-            if (!accept_net_wm_window_type(&nwwt))
-                continue;
-
-            tk = g_new0(task, 1);
-            tk->refcount = 1;
-            tb->num_tasks++;
-            tk->win = tb->wins[i];
-            tk->tb = tb;
-            tk->iconified = nws.hidden;
-            tk->desktop = get_net_wm_desktop(tk->win);
-            tk->nws = nws;
-            tk->nwwt = nwwt;
-            if( tb->use_urgency_hint && tk_has_urgency(tk)) {
-                tk->urgency = 1;
-            }
 
-            tk_build_gui(tb, tk);
-            tk_get_names(tk);
-            tk_set_names(tk);
+    tk = g_new0(task, 1);
+    tb->num_tasks++;
+    tk->win = c->win;
+    tk->c = c;
+    tk->tb = tb;
+    tk->iconified = c->nws.hidden;
+    tk->desktop = c->desktop;
+    if( tb->use_urgency_hint && tk_has_urgency(tk)) {
+        tk->urgency = 1;
+    }
 
-            g_hash_table_insert(tb->task_list, &tk->win, tk);
-            DBG("adding %08x(%p) %s\n", tk->win,
-                FBPANEL_WIN(tk->win), tk->name);
-        }
+    tk_get_names(tk);
+    g_hash_table_insert(tb->task_list, &tk->win, tk);
+    tb_index_add(tb, tk);
+    if (tb->group_by_class) {
+        grp_add(tb, tk);
+        if (tk->urgency)
+            tk_flash_window(tk);
     }
+    tk_display(tb, tk);
+    DBG("adding %08x(%p) %s\n", tk->win,
+        FBPANEL_WIN(tk->win), tk->name);
+    RET();
+}
 
-    /* remove windows that arn't in the NET_CLIENT_LIST anymore */
-    g_hash_table_foreach_remove(tb->task_list, (GHRFunc) task_remove_stale,
-        NULL);
-    tb_display(tb);
+static void
+tb_window_added(FbEv *ev, fb_client *c, taskbar_priv *tb)
+{
+    ENTER;
+    tb_add_task(c, tb);
+    RET();
+}
+
+static void
+tb_window_removed(FbEv *ev, fb_client *c, taskbar_priv *tb)
+{
+    task *tk;
+
+    ENTER;
+    if ((tk = find_task(tb, c->win)))
+        del_task(tb, tk, 1);
+    RET();
+}
+
+static void
+tb_window_changed(FbEv *ev, fb_client *c, taskbar_priv *tb)
+{
+    task *tk;
+
+    ENTER;
+    tk = find_task(tb, c->win);
+    if (c->changed & (FB_CLIENT_STATE | FB_CLIENT_TYPE)) {
+        if (!accept_net_wm_state(&c->nws, tb->accept_skip_pager)
+                || !accept_net_wm_window_type(&c->nwwt)) {
+            if (tk)
+                del_task(tb, tk, 1);
+            RET();
+        }
+        if (!tk) {
+            tb_add_task(c, tb);
+            RET();
+        }
+        if (tk->iconified != c->nws.hidden) {
+            tk->iconified = c->nws.hidden;
+            tk_set_names(tk);
+            tk_display(tb, tk);
+        }
+    }
+    if (!tk)
+        RET();
+    if (tk->button)
+        fb_trace_mark(tk->button, "taskbar");
+    if ((c->changed & FB_CLIENT_CLASS) && tk->group
+            && strcmp(tk->group->res_class,
+                c->ch.res_class ? c->ch.res_class : "")) {
+        int flash = tk->flash;
+
+        grp_remove(tb, tk);
+        grp_add(tb, tk);
+        if (flash)
+            tk_flash_window(tk);
+        tk_display(tb, tk);
+    }
+    if (c->changed & FB_CLIENT_DESKTOP) {
+        DBG("NET_WM_DESKTOP\n");
+        tb_index_remove(tb, tk);
+        tk->desktop = c->desktop;
+        tb_index_add(tb, tk);
+        tk_display(tb, tk);
+    }
+    if (c->changed & FB_CLIENT_NAME) {
+        DBG("WM_NAME\n");
+        tk_title_changed(tb, tk);
+    }
+    /* icon is fetched once task, or group it leads, gets its button */
+    if ((c->changed & (FB_CLIENT_HINTS | FB_CLIENT_ICON)) && (tk->button
+            || (tk->group && tk->group->icon_tk == tk && tk->group->button))) {
+        /* some windows set their WM_HINTS icon after mapping */
+        tk_update_icon (tb, tk,
+            (c->changed & FB_CLIENT_ICON) ? a_NET_WM_ICON : XA_WM_HINTS);
+    }
+    if ((c->changed & FB_CLIENT_HINTS) && tb->use_urgency_hint) {
+        if (tk_has_urgency(tk))
+            tk_flash_window(tk);
+        else
+            tk_unflash_window(tk);
+    }
     RET();
 }
 
@@ -1079,9 +1837,17 @@ tb_net_client_list(GtkWidget *widget, taskbar_priv *tb)
 static void
 tb_net_current_desktop(GtkWidget *widget, taskbar_priv *tb)
 {
+    guint old;
+
     ENTER;
-    tb->cur_desk = get_net_current_desktop();
-    tb_display(tb);
+    old = tb->cur_desk;
+    tb->cur_desk = fb_ev_current_desktop(fbev);
+    /* visibility of sticky tasks does not depend on current desktop */
+    if (tb->show_all_desks || old == tb->cur_desk)
+        RET();
+    fb_trace_mark(tb->bar, "taskbar");
+    tb_display_desk(tb, old);
+    tb_display_desk(tb, tb->cur_desk);
     RET();
 }
 
@@ -1090,8 +1856,9 @@ static void
 tb_net_number_of_desktops(GtkWidget *widget, taskbar_priv *tb)
 {
     ENTER;
-    tb->desk_num = get_net_number_of_desktops();
-    tb_display(tb);
+    /* task visibility does not depend on it; windows on removed
+     * desktops are moved by WM, and we hear about it */
+    tb->desk_num = fb_ev_number_of_desktops(fbev);
     RET();
 }
 
@@ -1101,7 +1868,7 @@ tb_net_number_of_desktops(GtkWidget *widget, taskbar_priv *tb)
 static void
 tb_net_active_window(GtkWidget *widget, taskbar_priv *tb)
 {
-    Window *f;
+    Window f;
     task *ntk, *ctk;
     int drop_old, make_new;
 
@@ -1110,146 +1877,52 @@ tb_net_active_window(GtkWidget *widget, taskbar_priv *tb)
     drop_old = make_new = 0;
     ctk = tb->focused;
     ntk = NULL;
-    f = get_xaproperty(GDK_ROOT_WINDOW(), a_NET_ACTIVE_WINDOW, XA_WINDOW, 0);
-    DBG("FOCUS=%x\n", f ? *f : 0);
-    if (!f) {
+    f = fb_ev_active_window(fbev);
+    DBG("FOCUS=%x\n", f);
+    if (f == None) {
         drop_old = 1;
         tb->ptk = NULL;
     } else {
-        if (*f == tb->topxwin) {
+        if (f == tb->topxwin) {
             if (ctk) {
                 tb->ptk = ctk;
                 drop_old = 1;
             }
         } else {
             tb->ptk = NULL;
-            ntk = find_task(tb, *f);
+            ntk = find_task(tb, f);
             if (ntk != ctk) {
                 drop_old = 1;
                 make_new = 1;
             }
         }
-        XFree(f);
     }
     if (ctk && drop_old) {
         ctk->focused = 0;
         tb->focused = NULL;
+        if (ctk->button)
+            fb_trace_mark(ctk->button, "taskbar");
         tk_display(tb, ctk);
         DBG("old focus was dropped\n");
     }
     if (ntk && make_new) {
         ntk->focused = 1;
         tb->focused = ntk;
+        if (ntk->button)
+            fb_trace_mark(ntk->button, "taskbar");
         tk_display(tb, ntk);
         DBG("new focus was set\n");
     }
     RET();
 }
 
-/* For older Xlib headers */
-#ifndef XUrgencyHint
-#define XUrgencyHint (1 << 8)
-#endif
-
 static gboolean
 tk_has_urgency( task* tk )
 {
-    XWMHints* hints;
-
-    tk->urgency = 0;
-    hints = XGetWMHints(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), tk->win);
-    if (hints) {
-        if (hints->flags & XUrgencyHint) /* Got urgency hint */
-            tk->urgency = 1;
-        XFree( hints );
-    }
+    tk->urgency = tk->c->urgency;
     return tk->urgency;
 }
 
-static void
-tb_propertynotify(taskbar_priv *tb, XEvent *ev)
-{
-    Atom at;
-    Window win;
-
-    ENTER;
-    DBG("win=%x\n", ev->xproperty.window);
-    at = ev->xproperty.atom;
-    win = ev->xproperty.window;
-    if (win != GDK_ROOT_WINDOW()) {
-        task *tk = find_task(tb, win);
-
-        if (!tk) RET();
-        DBG("win=%x\n", ev->xproperty.window);
-        if (at == a_NET_WM_DESKTOP) {
-            DBG("NET_WM_DESKTOP\n");
-            tk->desktop = get_net_wm_desktop(win);
-            tb_display(tb);
-        } else if (at == XA_WM_NAME) {
-            DBG("WM_NAME\n");
-            tk_get_names(tk);
-            tk_set_names(tk);
-        } else if (at == XA_WM_HINTS)   {
-            /* some windows set their WM_HINTS icon after mapping */
-            DBG("XA_WM_HINTS\n");
-            tk_update_icon (tb, tk, XA_WM_HINTS);
-            gtk_image_set_from_pixbuf (GTK_IMAGE(tk->image), tk->pixbuf);
-            if (tb->use_urgency_hint) {
-                if (tk_has_urgency(tk)) {
-                    //tk->urgency = 1;
-                    tk_flash_window(tk);
-                } else {
-                    //tk->urgency = 0;
-                    tk_unflash_window(tk);
-                }
-            }
-        } else if (at == a_NET_WM_STATE) {
-            net_wm_state nws;
-
-            DBG("_NET_WM_STATE\n");
-            get_net_wm_state(tk->win, &nws);
-            if (!accept_net_wm_state(&nws, tb->accept_skip_pager)) {
-                del_task(tb, tk, 1);
-                tb_display(tb);
-            } else {
-                tk->iconified = nws.hidden;
-                tk_set_names(tk);
-            }
-        } else if (at == a_NET_WM_ICON) {
-            DBG("_NET_WM_ICON\n");
-            DBG("#0 %d\n", GDK_IS_PIXBUF (tk->pixbuf));
-            tk_update_icon (tb, tk, a_NET_WM_ICON);
-            DBG("#1 %d\n", GDK_IS_PIXBUF (tk->pixbuf));
-            gtk_image_set_from_pixbuf (GTK_IMAGE(tk->image), tk->pixbuf);
-            DBG("#2 %d\n", GDK_IS_PIXBUF (tk->pixbuf));
-        } else if (at == a_NET_WM_WINDOW_TYPE) {
-            net_wm_window_type nwwt;
-
-            DBG("_NET_WM_WINDOW_TYPE\n");
-            get_net_wm_window_type(tk->win, &nwwt);
-            if (!accept_net_wm_window_type(&nwwt)) {
-                del_task(tb, tk, 1);
-                tb_display(tb);
-            }
-        } else {
-            DBG("at = %d\n", at);
-        }
-    }
-    RET();
-}
-
-static GdkFilterReturn
-tb_event_filter( XEvent *xev, GdkEvent *event, taskbar_priv *tb)
-{
-
-    ENTER;
-    //RET(GDK_FILTER_CONTINUE);
-    g_assert(tb != NULL);
-    if (xev->type == PropertyNotify )
-        tb_propertynotify(tb, xev);
-    RET(GDK_FILTER_CONTINUE);
-}
-
 static void
 menu_close_window(GtkWidget *widget, taskbar_priv *tb)
 {
@@ -1303,11 +1976,7 @@ static void
 tb_update_desktops_names(taskbar_priv *tb)
 {
     ENTER;
-    tb->desk_namesno = get_net_number_of_desktops();
-    if (tb->desk_names)
-        g_strfreev(tb->desk_names);
-    tb->desk_names = get_utf8_property_list(GDK_ROOT_WINDOW(),
-        a_NET_DESKTOP_NAMES, &(tb->desk_namesno));
+    tb->desk_names = fb_ev_desktop_names(fbev, &tb->desk_namesno);
     RET();
 }
 
@@ -1418,23 +2087,25 @@ taskbar_build_gui(plugin_instance *p)
 
     tb->gen_pixbuf = gdk_pixbuf_new_from_xpm_data((const char **)icon_xpm);
 
-    gdk_window_add_filter(NULL, (GdkFilterFunc)tb_event_filter, tb );
-
     g_signal_connect (G_OBJECT (fbev), "current_desktop",
           G_CALLBACK (tb_net_current_desktop), (gpointer) tb);
     g_signal_connect (G_OBJECT (fbev), "active_window",
           G_CALLBACK (tb_net_active_window), (gpointer) tb);
     g_signal_connect (G_OBJECT (fbev), "number_of_desktops",
           G_CALLBACK (tb_net_number_of_desktops), (gpointer) tb);
-    g_signal_connect (G_OBJECT (fbev), "client_list",
-          G_CALLBACK (tb_net_client_list), (gpointer) tb);
+    g_signal_connect (G_OBJECT (fbev), "window_added",
+          G_CALLBACK (tb_window_added), (gpointer) tb);
+    g_signal_connect (G_OBJECT (fbev), "window_changed",
+          G_CALLBACK (tb_window_changed), (gpointer) tb);
+    g_signal_connect (G_OBJECT (fbev), "window_removed",
+          G_CALLBACK (tb_window_removed), (gpointer) tb);
     g_signal_connect (G_OBJECT (fbev), "desktop_names",
           G_CALLBACK (tb_make_menu), (gpointer) tb);
     g_signal_connect (G_OBJECT (fbev), "number_of_desktops",
           G_CALLBACK (tb_make_menu), (gpointer) tb);
     
-    tb->desk_num = get_net_number_of_desktops();
-    tb->cur_desk = get_net_current_desktop();
+    tb->desk_num = fb_ev_number_of_desktops(fbev);
+    tb->cur_desk = fb_ev_current_desktop(fbev);
     tb->focused = NULL;
     tb->menu = NULL;
     
@@ -1485,11 +2156,14 @@ taskbar_constructor(plugin_instance *p)
     tb->task_width_max    = TASK_WIDTH_MAX;
     tb->task_height_max   = p->panel->max_elem_height;
     tb->task_list         = g_hash_table_new(g_int_hash, g_int_equal);
+    tb->desk_tasks        = g_hash_table_new(g_direct_hash, g_direct_equal);
     tb->focused_state     = GTK_STATE_ACTIVE;
     tb->normal_state      = GTK_STATE_NORMAL;
     tb->spacing           = 0;
     tb->use_mouse_wheel   = 1;
     tb->use_urgency_hint  = 1;
+    tb->relabel_interval  = 250;
+    tb->group_by_class    = 0;
 
     XCG(xc, "tooltips", &tb->tooltips, enum, bool_enum);
     XCG(xc, "iconsonly", &tb->icons_only, enum, bool_enum);
@@ -1500,6 +2174,8 @@ taskbar_constructor(plugin_instance *p)
     XCG(xc, "usemousewheel", &tb->use_mouse_wheel, enum, bool_enum);
     XCG(xc, "useurgencyhint", &tb->use_urgency_hint, enum, bool_enum);
     XCG(xc, "maxtaskwidth", &tb->task_width_max, int);
+    XCG(xc, "minrelabelinterval", &tb->relabel_interval, int);
+    XCG(xc, "groupbyclass", &tb->group_by_class, enum, bool_enum);
 
     /* FIXME: until per-plugin elem height limit is ready, lets
      * use hardcoded TASK_HEIGHT_MAX pixels */
@@ -1516,8 +2192,18 @@ taskbar_constructor(plugin_instance *p)
         if (tb->icons_only)
             tb->task_width_max = tb->iconsize + req.height;
     }
+    if (tb->relabel_interval < 0)
+        tb->relabel_interval = 0;
+    if (!titles_users++) {
+        fb_xstat_add_counter("taskbar titles relabeled", &titles_relabeled);
+        fb_xstat_add_counter("taskbar titles unchanged", &titles_unchanged);
+        fb_xstat_add_counter("taskbar titles deferred", &titles_deferred);
+    }
+    if (tb->group_by_class)
+        tb->groups = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) grp_free);
     taskbar_build_gui(p);
-    tb_net_client_list(NULL, tb);
+    fb_ev_client_foreach(fbev, (GFunc) tb_add_task, tb);
     tb_display(tb);
     tb_net_active_window(NULL, tb);
     RET(1);
@@ -1530,7 +2216,6 @@ taskbar_destructor(plugin_instance *p)
     taskbar_priv *tb = (taskbar_priv *) p;
 
     ENTER;
-    gdk_window_remove_filter(NULL, (GdkFilterFunc)tb_event_filter, tb);
     g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
             tb_net_current_desktop, tb);
     g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
@@ -1538,13 +2223,26 @@ taskbar_destructor(plugin_instance *p)
     g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
             tb_net_number_of_desktops, tb);
     g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
-            tb_net_client_list, tb);
+            tb_window_added, tb);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
+            tb_window_changed, tb);
+    g_signal_handlers_disconnect_by_func(G_OBJECT (fbev),
+            tb_window_removed, tb);
 
     g_hash_table_foreach_remove(tb->task_list, (GHRFunc) task_remove_every,
             NULL);
     g_hash_table_destroy(tb->task_list);
-    if (tb->wins)
-        XFree(tb->wins);
+    g_hash_table_destroy(tb->desk_tasks);
+    if (tb->groups)
+        g_hash_table_destroy(tb->groups);
+    if (tb->group_menu)
+        gtk_widget_destroy(tb->group_menu);
+    if (!--titles_users) {
+        fb_xstat_remove_counter(&titles_relabeled);
+        fb_xstat_remove_counter(&titles_unchanged);
+        fb_xstat_remove_counter(&titles_deferred);
+    }
+    g_slist_free(tb->pool);
     //gtk_widget_destroy(tb->bar); // destroy of p->pwid does it all
     gtk_widget_destroy(tb->menu);
     DBG("alloc_no=%d\n", tb->alloc_no);
@@ -36,32 +36,30 @@ toggle_shaded(wincmd_priv *wc, guint32 action)
     Window *win = NULL;
     int num, i;
     guint32 tmp2, dno;
-    net_wm_window_type nwwt;
+    fb_client *c;
     
     ENTER;
-    win = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_CLIENT_LIST,
-        XA_WINDOW, &num);
-    if (!win)
+    win = fb_ev_client_list(fbev, &num);
+    if (!win || !num)
 	RET();
-    if (!num)
-        goto end;
     //tmp = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_CURRENT_DESKTOP,
     // XA_CARDINAL, 0);
     //dno = *tmp;
-    dno = get_net_current_desktop();
+    dno = fb_ev_current_desktop(fbev);
     DBG("wincmd: #desk=%d\n", dno);
     //XFree(tmp);
     for (i = 0; i < num; i++) {
         int skip;
 
-        tmp2 = get_net_wm_desktop(win[i]);
+        if (!(c = fb_ev_client_lookup(fbev, win[i])))
+            continue;
+        tmp2 = c->desktop;
         DBG("wincmd: win=0x%x dno=%d...", win[i], tmp2);
         if ((tmp2 != -1) && (tmp2 != dno)) {
             DBG("skip - not cur desk\n");
             continue;
         }
-        get_net_wm_window_type(win[i], &nwwt);
-        skip = (nwwt.dock || nwwt.desktop || nwwt.splash);
+        skip = (c->nwwt.dock || c->nwwt.desktop || c->nwwt.splash);
         if (skip) {
             DBG("skip - omnipresent window type\n");
             continue;
@@ -71,9 +69,6 @@ toggle_shaded(wincmd_priv *wc, guint32 action)
               a_NET_WM_STATE_SHADED, 0, 0, 0);
         DBG("ok\n");
     }
-    
- end:
-    XFree(win);
     RET();
 }
 
@@ -85,32 +80,28 @@ toggle_iconify(wincmd_priv *wc)
     Window *win, *awin;
     int num, i, j, dno, raise;
     guint32 tmp;
-    net_wm_window_type nwwt;
-    net_wm_state nws;
+    fb_client *c;
 
     ENTER;
-    win = get_xaproperty (GDK_ROOT_WINDOW(), a_NET_CLIENT_LIST_STACKING,
-            XA_WINDOW, &num);
-    if (!win)
+    win = fb_ev_client_list_stacking(fbev, &num);
+    if (!win || !num)
 	RET();
-    if (!num)
-        goto end;
     awin = g_new(Window, num);
-    dno = get_net_current_desktop();
+    dno = fb_ev_current_desktop(fbev);
     raise = 1;
     for (j = 0, i = 0; i < num; i++) {
-        tmp = get_net_wm_desktop(win[i]);
+        if (!(c = fb_ev_client_lookup(fbev, win[i])))
+            continue;
+        tmp = c->desktop;
         DBG("wincmd: win=0x%x dno=%d...", win[i], tmp);
         if ((tmp != -1) && (tmp != dno))
             continue;
 
-        get_net_wm_window_type(win[i], &nwwt);
-        tmp = (nwwt.dock || nwwt.desktop || nwwt.splash);
+        tmp = (c->nwwt.dock || c->nwwt.desktop || c->nwwt.splash);
         if (tmp) 
             continue;
 
-        get_net_wm_state(win[i], &nws);
-        raise = raise && (nws.hidden || nws.shaded);; 
+        raise = raise && (c->nws.hidden || c->nws.shaded);; 
         awin[j++] = win[i];
     }
     while (j-- > 0) {
@@ -121,8 +112,6 @@ toggle_iconify(wincmd_priv *wc)
     }
     
     g_free(awin);
- end:
-    XFree(win);
     RET();
 }
 